@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CALIBRATOR_HPP
+#define CALIBRATOR_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/**
+ * This class picks the encoder speed setting (cpu-used) that gives the best
+ * quality while encoding within the frame budget. Candidates are tried on
+ * live frames from the fastest to the slowest one; every candidate is used
+ * for a given number of frames and accepted if the 99th percentile of its
+ * encoding time is within the budget. The first candidate exceeding the
+ * budget ends the calibration with the previously accepted one.
+ *
+ * Example:
+ * @code
+ * Calibrator calibrator{{9, 8, 7, 6, 5}, 20, 50000};
+ * vpx_codec_control(&codec, VP8E_SET_CPUUSED, calibrator.candidate());
+ * ...
+ * calibrator.budget(frameInterval);
+ * if (calibrator.calibrating() && calibrator.update(encodingDuration)) {
+ *     vpx_codec_control(&codec, VP8E_SET_CPUUSED, calibrator.candidate());
+ * }
+ * @endcode
+ */
+class Calibrator {
+   private:
+    Calibrator(const Calibrator &) = delete;
+    Calibrator(Calibrator &&)      = delete;
+    Calibrator &operator=(const Calibrator &) = delete;
+    Calibrator &operator=(Calibrator &&) = delete;
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param candidates cpu-used values ordered from the fastest to the slowest.
+     * @param framesPerCandidate Number of frames to measure per candidate.
+     * @param budget Time to encode one frame in microseconds.
+     */
+    Calibrator(const std::vector<int32_t> &candidates, uint32_t framesPerCandidate, int64_t budget) noexcept
+        : m_candidates{candidates}
+        , m_framesPerCandidate{std::max(framesPerCandidate, 1u)}
+        , m_budget{budget}
+        , m_samples()
+        , m_percentiles(candidates.size(), 0) {
+        m_samples.reserve(m_framesPerCandidate);
+        m_calibrating = !m_candidates.empty();
+    }
+
+    /**
+     * @return true while candidates are measured.
+     */
+    bool calibrating() const noexcept {
+        return m_calibrating;
+    }
+
+    /**
+     * @return cpu-used value to encode the next frame with.
+     */
+    int32_t candidate() const noexcept {
+        return m_candidates.empty() ? 0 : m_candidates[m_current];
+    }
+
+    /**
+     * @param index Index of the candidate.
+     * @return cpu-used value of the given candidate.
+     */
+    int32_t candidate(uint32_t index) const noexcept {
+        return (index < m_candidates.size()) ? m_candidates[index] : 0;
+    }
+
+    /**
+     * This method adds the encoding time for the last frame.
+     *
+     * @param encodingDuration Encoding time in microseconds.
+     * @return true if candidate() changed.
+     */
+    bool update(int64_t encodingDuration) noexcept {
+        if (!m_calibrating) {
+            return false;
+        }
+        m_samples.push_back(encodingDuration);
+        if (m_samples.size() < m_framesPerCandidate) {
+            return false;
+        }
+
+        // 99th percentile of the measured encoding times.
+        const uint32_t INDEX{(static_cast<uint32_t>(m_samples.size()) * 99 + 99) / 100 - 1};
+        std::nth_element(m_samples.begin(), m_samples.begin() + INDEX, m_samples.end());
+        m_percentiles[m_current] = m_samples[INDEX];
+        m_samples.clear();
+
+        const uint32_t PREVIOUS{m_current};
+        if (m_percentiles[m_current] <= m_budget) {
+            m_accepted = m_current;
+            m_calibrating = (m_current + 1 < m_candidates.size());
+            m_current = m_calibrating ? (m_current + 1) : m_current;
+        }
+        else {
+            m_calibrating = false;
+            m_current = m_accepted;
+        }
+        return (PREVIOUS != m_current);
+    }
+
+    /**
+     * @param index Index of the candidate.
+     * @return 99th percentile of the encoding time in microseconds or 0 if not measured.
+     */
+    int64_t percentile(uint32_t index) const noexcept {
+        return (index < m_percentiles.size()) ? m_percentiles[index] : 0;
+    }
+
+    /**
+     * @return Index of the chosen candidate.
+     */
+    uint32_t chosen() const noexcept {
+        return m_current;
+    }
+
+    /**
+     * @return Number of candidates.
+     */
+    uint32_t size() const noexcept {
+        return static_cast<uint32_t>(m_candidates.size());
+    }
+
+    /**
+     * @param budget Time to encode one frame in microseconds from now on.
+     */
+    void budget(int64_t budget) noexcept {
+        m_budget = budget;
+    }
+
+    /**
+     * @return Budget in microseconds.
+     */
+    int64_t budget() const noexcept {
+        return m_budget;
+    }
+
+   private:
+    const std::vector<int32_t> m_candidates;
+    const uint32_t m_framesPerCandidate;
+    int64_t m_budget;
+
+    bool m_calibrating{false};
+    uint32_t m_current{0};
+    uint32_t m_accepted{0};
+    std::vector<int64_t> m_samples;
+    std::vector<int64_t> m_percentiles;
+};
+
+#endif
@@ -0,0 +1,436 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONTAINER_WRITER_HPP
+#define CONTAINER_WRITER_HPP
+
+#include "file-writer.hpp"
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * This class writes VP8 or VP9 frames into an IVF file as read by vpxdec and
+ * ffmpeg. Time stamps are given in microseconds and stored relative to the
+ * first frame with a time base of 1/1,000,000; the number of frames in the
+ * file header is left at 0 as the file is written as a stream.
+ */
+class IvfWriter {
+   private:
+    IvfWriter(const IvfWriter &) = delete;
+    IvfWriter(IvfWriter &&)      = delete;
+    IvfWriter &operator=(const IvfWriter &) = delete;
+    IvfWriter &operator=(IvfWriter &&) = delete;
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param filename Name of the file to write.
+     * @param vp8 true for VP8, false for VP9.
+     * @param width Width of the frames.
+     * @param height Height of the frames.
+     * @param maxFrameSize Size of the largest frame.
+     */
+    IvfWriter(const std::string &filename, bool vp8, uint32_t width, uint32_t height, uint32_t maxFrameSize) noexcept
+        : m_file{filename, std::max<uint32_t>(1024 * 1024, maxFrameSize + 4096), NUMBER_OF_BUFFERS, 0, std::chrono::seconds(0)} {
+        char header[32]{'D', 'K', 'I', 'F'};
+        le16(header + 4, 0);   // Version.
+        le16(header + 6, 32);  // Size of this header.
+        header[8] = 'V';
+        header[9] = 'P';
+        header[10] = vp8 ? '8' : '9';
+        header[11] = '0';
+        le16(header + 12, width);
+        le16(header + 14, height);
+        le32(header + 16, 1000000);  // Time base denominator.
+        le32(header + 20, 1);        // Time base numerator.
+        le32(header + 24, 0);        // Number of frames.
+        struct iovec part;
+        part.iov_base = header;
+        part.iov_len = sizeof(header);
+        m_file.write(&part, 1);
+    }
+
+    /**
+     * @return true if the file could be opened.
+     */
+    bool valid() const noexcept {
+        return m_file.valid();
+    }
+
+    /**
+     * This method appends a frame.
+     *
+     * @param data Frame.
+     * @param size Size of the frame.
+     * @param timeStamp Capture time of the frame in microseconds.
+     * @return true if the frame was accepted.
+     */
+    bool write(const char *data, uint32_t size, int64_t timeStamp) noexcept {
+        if (m_first < 0) {
+            m_first = timeStamp;
+        }
+        // Time stamps must not decrease.
+        m_last = std::max(m_last, timeStamp - m_first);
+        le32(m_frameHeader, size);
+        le32(m_frameHeader + 4, static_cast<uint32_t>(m_last & 0xFFFFFFFF));
+        le32(m_frameHeader + 8, static_cast<uint32_t>(static_cast<uint64_t>(m_last) >> 32));
+        struct iovec parts[2];
+        parts[0].iov_base = m_frameHeader;
+        parts[0].iov_len = sizeof(m_frameHeader);
+        parts[1].iov_base = const_cast<char*>(data);
+        parts[1].iov_len = size;
+        return m_file.write(parts, 2);
+    }
+
+    /**
+     * This method passes frames that waited for a second to the disk; it is
+     * to be called while there are no frames to write.
+     */
+    void flushOld() noexcept {
+        m_file.flushOld();
+    }
+
+    /**
+     * @return Number of frames dropped as the disk fell behind.
+     */
+    uint64_t framesDropped() const noexcept {
+        return m_file.recordsDropped();
+    }
+
+   private:
+    static void le16(char *dst, uint32_t v) noexcept {
+        dst[0] = static_cast<char>(v & 0xFF);
+        dst[1] = static_cast<char>((v >> 8) & 0xFF);
+    }
+    static void le32(char *dst, uint32_t v) noexcept {
+        le16(dst, v & 0xFFFF);
+        le16(dst + 2, v >> 16);
+    }
+
+   private:
+    static constexpr uint32_t NUMBER_OF_BUFFERS{4};
+
+    FileWriter m_file;
+    int64_t m_first{-1};
+    int64_t m_last{0};
+    char m_frameHeader[12]{};
+};
+
+/**
+ * This class writes VP8 or VP9 frames as SimpleBlocks into a WebM file with
+ * one video track. Segment and Clusters are written with unknown size so that
+ * every frame is appended as soon as it is encoded and a file that was cut off
+ * (e.g., by a power loss) can be played up to its last complete frame. A new
+ * Cluster starts at the first keyframe at least one second after the start of
+ * the current Cluster and after 30 seconds at the latest; the Cues pointing to
+ * the Clusters that start with a keyframe are written when the file is closed.
+ * Then, the space reserved at the start of the Segment is overwritten with a
+ * SeekHead pointing to Info, Tracks, and Cues, and the size of the Segment is
+ * set, so that players find the Cues without reading the whole file. Time
+ * stamps are given in microseconds and stored relative to the first frame in
+ * milliseconds.
+ */
+class WebmWriter {
+   private:
+    WebmWriter(const WebmWriter &) = delete;
+    WebmWriter(WebmWriter &&)      = delete;
+    WebmWriter &operator=(const WebmWriter &) = delete;
+    WebmWriter &operator=(WebmWriter &&) = delete;
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param filename Name of the file to write.
+     * @param vp8 true for VP8, false for VP9.
+     * @param width Width of the frames.
+     * @param height Height of the frames.
+     * @param maxFrameSize Size of the largest frame.
+     */
+    WebmWriter(const std::string &filename, bool vp8, uint32_t width, uint32_t height, uint32_t maxFrameSize) noexcept
+        : m_filename{filename}
+        , m_file{new FileWriter{filename, std::max<uint32_t>(1024 * 1024, maxFrameSize + 4096), NUMBER_OF_BUFFERS, 0, std::chrono::seconds(0)}} {
+        std::string ebml;
+        unsignedInt(ebml, 0x4286, 1);  // EBMLVersion
+        unsignedInt(ebml, 0x42F7, 1);  // EBMLReadVersion
+        unsignedInt(ebml, 0x42F2, 4);  // EBMLMaxIDLength
+        unsignedInt(ebml, 0x42F3, 8);  // EBMLMaxSizeLength
+        text(ebml, 0x4282, "webm");  // DocType
+        unsignedInt(ebml, 0x4287, 4);  // DocTypeVersion
+        unsignedInt(ebml, 0x4285, 2);  // DocTypeReadVersion
+
+        std::string info;
+        unsignedInt(info, 0x2AD7B1, TIMECODE_SCALE);  // TimecodeScale
+        text(info, 0x4D80, "opendlv-video-vpx-encoder");  // MuxingApp
+        text(info, 0x5741, "opendlv-video-vpx-encoder");  // WritingApp
+
+        std::string video;
+        unsignedInt(video, 0xB0, width);   // PixelWidth
+        unsignedInt(video, 0xBA, height);  // PixelHeight
+        std::string trackEntry;
+        unsignedInt(trackEntry, 0xD7, TRACK_NUMBER);  // TrackNumber
+        unsignedInt(trackEntry, 0x73C5, 1);           // TrackUID
+        unsignedInt(trackEntry, 0x83, 1);             // TrackType: video
+        text(trackEntry, 0x86, (vp8 ? "V_VP8" : "V_VP9"));  // CodecID
+        master(trackEntry, 0xE0, video);  // Video
+        std::string tracks;
+        master(tracks, 0xAE, trackEntry);  // TrackEntry
+
+        std::string header;
+        master(header, 0x1A45DFA3, ebml);  // EBML
+        id(header, 0x18538067);            // Segment
+        size(header, UNKNOWN_SIZE);
+        m_segmentStart = header.size();
+        voidElement(header, SEEK_HEAD_SIZE);
+        m_infoPosition = header.size() - m_segmentStart;
+        master(header, 0x1549A966, info);    // Info
+        m_tracksPosition = header.size() - m_segmentStart;
+        master(header, 0x1654AE6B, tracks);  // Tracks
+        append(header.data(), static_cast<uint32_t>(header.size()));
+        m_position = header.size() - m_segmentStart;
+        m_cues.reserve(RESERVED_CUES);
+    }
+
+    ~WebmWriter() noexcept {
+        uint64_t cuesPosition{0};
+        if (!m_cues.empty()) {
+            std::string cues;
+            for (auto &c : m_cues) {
+                std::string positions;
+                unsignedInt(positions, 0xF7, TRACK_NUMBER);  // CueTrack
+                unsignedInt(positions, 0xF1, c.second);      // CueClusterPosition
+                std::string point;
+                unsignedInt(point, 0xB3, static_cast<uint64_t>(c.first));  // CueTime
+                master(point, 0xB7, positions);  // CueTrackPositions
+                master(cues, 0xBB, point);       // CuePoint
+            }
+            std::string element;
+            master(element, 0x1C53BB6B, cues);  // Cues
+            const uint64_t POSITION{m_position};
+            cuesPosition = append(element.data(), static_cast<uint32_t>(element.size())) ? POSITION : 0;
+        }
+        if (!m_file->valid()) {
+            return;
+        }
+        // All buffers are written when the FileWriter is destroyed.
+        m_file.reset();
+
+        std::string seekHead;
+        seek(seekHead, 0x1549A966, m_infoPosition);    // Info
+        seek(seekHead, 0x1654AE6B, m_tracksPosition);  // Tracks
+        if (0 < cuesPosition) {
+            seek(seekHead, 0x1C53BB6B, cuesPosition);  // Cues
+        }
+        std::string reserved;
+        master(reserved, 0x114D9B74, seekHead);  // SeekHead
+        voidElement(reserved, SEEK_HEAD_SIZE - static_cast<uint32_t>(reserved.size()));
+        std::string segmentSize;
+        size(segmentSize, m_position);
+
+        const int32_t FD{::open(m_filename.c_str(), O_WRONLY)};
+        if (!(FD < 0)) {
+            const bool PATCHED{(static_cast<ssize_t>(reserved.size()) == ::pwrite(FD, reserved.data(), reserved.size(), static_cast<off_t>(m_segmentStart)))
+                               && (static_cast<ssize_t>(segmentSize.size()) == ::pwrite(FD, segmentSize.data(), segmentSize.size(), static_cast<off_t>(m_segmentStart - segmentSize.size())))};
+            ::close(FD);
+            if (PATCHED) {
+                return;
+            }
+        }
+        std::cerr << "[opendlv-video-vpx-encoder]: Failed to write SeekHead into '" << m_filename << "'." << std::endl;
+    }
+
+    /**
+     * @return true if the file could be opened.
+     */
+    bool valid() const noexcept {
+        return m_file->valid();
+    }
+
+    /**
+     * This method appends a frame.
+     *
+     * @param data Frame.
+     * @param size Size of the frame.
+     * @param timeStamp Capture time of the frame in microseconds.
+     * @param keyFrame true if the frame is a keyframe.
+     * @return true if the frame was accepted.
+     */
+    bool write(const char *data, uint32_t size, int64_t timeStamp, bool keyFrame) noexcept {
+        if (m_first < 0) {
+            m_first = timeStamp;
+        }
+        // Time stamps must not decrease.
+        m_last = std::max(m_last, (timeStamp - m_first) / 1000);
+
+        const int64_t SINCE_CLUSTER{m_last - m_cluster};
+        if ((m_cluster < 0) || (keyFrame && (MIN_CLUSTER_DURATION <= SINCE_CLUSTER)) || (MAX_CLUSTER_DURATION <= SINCE_CLUSTER)) {
+            const uint64_t POSITION{m_position};
+            char cluster[32];
+            uint32_t length{0};
+            length += put(cluster + length, 0x1F43B675, 4);  // Cluster
+            length += put(cluster + length, UNKNOWN_SIZE, 8);
+            length += put(cluster + length, 0xE7, 1);  // Timecode
+            length += put(cluster + length, 0x88, 1);  // Size of the timecode: 8 bytes
+            length += put(cluster + length, static_cast<uint64_t>(m_last), 8);
+            if (!append(cluster, length)) {
+                return false;
+            }
+            m_cluster = m_last;
+            if (keyFrame) {
+                m_cues.push_back(std::make_pair(m_last, POSITION));
+            }
+        }
+
+        // SimpleBlock with track number, relative timecode, and flags.
+        uint32_t length{put(m_blockHeader, 0xA3, 1)};
+        length += put(m_blockHeader + length, 0x0100000000000000ull | (4ull + size), 8);
+        length += put(m_blockHeader + length, 0x80 | TRACK_NUMBER, 1);
+        length += put(m_blockHeader + length, static_cast<uint64_t>(m_last - m_cluster), 2);
+        length += put(m_blockHeader + length, (keyFrame ? 0x80 : 0x00), 1);
+        struct iovec parts[2];
+        parts[0].iov_base = m_blockHeader;
+        parts[0].iov_len = length;
+        parts[1].iov_base = const_cast<char*>(data);
+        parts[1].iov_len = size;
+        if (!m_file->write(parts, 2)) {
+            return false;
+        }
+        m_position += length + size;
+        return true;
+    }
+
+    /**
+     * This method passes frames that waited for a second to the disk; it is
+     * to be called while there are no frames to write.
+     */
+    void flushOld() noexcept {
+        if (m_file) {
+            m_file->flushOld();
+        }
+    }
+
+    /**
+     * @return Number of frames dropped as the disk fell behind.
+     */
+    uint64_t framesDropped() const noexcept {
+        return m_file->recordsDropped();
+    }
+
+   private:
+    // Writes the lowest bytes of v in big-endian order.
+    static uint32_t put(char *dst, uint64_t v, uint32_t bytes) noexcept {
+        for (uint32_t i{0}; i < bytes; i++) {
+            dst[i] = static_cast<char>((v >> (8 * (bytes - 1 - i))) & 0xFF);
+        }
+        return bytes;
+    }
+
+    static void id(std::string &out, uint32_t id) noexcept {
+        char buffer[4];
+        const uint32_t BYTES{(0xFFFFFF < id) ? 4u : ((0xFFFF < id) ? 3u : ((0xFF < id) ? 2u : 1u))};
+        out.append(buffer, put(buffer, id, BYTES));
+    }
+
+    // Sizes are always written with 8 bytes.
+    static void size(std::string &out, uint64_t v) noexcept {
+        char buffer[8];
+        out.append(buffer, put(buffer, 0x0100000000000000ull | v, 8));
+    }
+
+    static void unsignedInt(std::string &out, uint32_t elementId, uint64_t v) noexcept {
+        char buffer[8];
+        id(out, elementId);
+        size(out, 8);
+        out.append(buffer, put(buffer, v, 8));
+    }
+
+    static void text(std::string &out, uint32_t elementId, const std::string &v) noexcept {
+        id(out, elementId);
+        size(out, v.size());
+        out.append(v);
+    }
+
+    static void master(std::string &out, uint32_t elementId, const std::string &children) noexcept {
+        id(out, elementId);
+        size(out, children.size());
+        out.append(children);
+    }
+
+    // Void element of the given total size (at least 9 bytes).
+    static void voidElement(std::string &out, uint32_t totalSize) noexcept {
+        id(out, 0xEC);  // Void
+        size(out, totalSize - 9);
+        out.append(totalSize - 9, '\0');
+    }
+
+    static void seek(std::string &out, uint32_t elementId, uint64_t position) noexcept {
+        std::string elementIdBytes;
+        id(elementIdBytes, elementId);
+        std::string entry;
+        text(entry, 0x53AB, elementIdBytes);    // SeekID
+        unsignedInt(entry, 0x53AC, position);  // SeekPosition
+        master(out, 0x4DBB, entry);            // Seek
+    }
+
+    bool append(const char *data, uint32_t size) noexcept {
+        struct iovec part;
+        part.iov_base = const_cast<char*>(data);
+        part.iov_len = size;
+        const bool retVal{m_file->write(&part, 1)};
+        m_position += (retVal ? size : 0);
+        return retVal;
+    }
+
+   private:
+    static constexpr uint32_t NUMBER_OF_BUFFERS{4};
+    static constexpr uint64_t TIMECODE_SCALE{1000000};  // Nanoseconds per tick.
+    static constexpr uint32_t TRACK_NUMBER{1};
+    static constexpr int64_t MIN_CLUSTER_DURATION{1000};
+    static constexpr int64_t MAX_CLUSTER_DURATION{30000};
+    // Cues for one hour of Clusters of MIN_CLUSTER_DURATION, so that the publishing thread does not allocate before.
+    static constexpr uint32_t RESERVED_CUES{3600};
+    static constexpr uint64_t UNKNOWN_SIZE{0x01FFFFFFFFFFFFFFull};
+    // SeekHead with three Seeks of 42 bytes each and a Void of at least 9 bytes.
+    static constexpr uint32_t SEEK_HEAD_SIZE{160};
+
+    const std::string m_filename;
+    std::unique_ptr<FileWriter> m_file;
+    uint64_t m_segmentStart{0};  // Position of the Segment's data in the file.
+    uint64_t m_infoPosition{0};
+    uint64_t m_tracksPosition{0};
+    uint64_t m_position{0};  // Bytes written after the Segment's header.
+    int64_t m_first{-1};
+    int64_t m_last{0};
+    int64_t m_cluster{-1};
+    std::vector<std::pair<int64_t, uint64_t> > m_cues{};  // Timecode and position of Clusters starting with a keyframe.
+    char m_blockHeader[16]{};
+};
+
+#endif
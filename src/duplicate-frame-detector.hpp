@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DUPLICATE_FRAME_DETECTOR_HPP
+#define DUPLICATE_FRAME_DETECTOR_HPP
+
+#include <cstdint>
+
+/**
+ * This class recognizes frames in a shared memory area that were already
+ * encoded, e.g., when a notification arrives without new content after a
+ * producer restarted or when several producers notify the same area. A
+ * frame is a duplicate if the producer's time stamp did not change; when
+ * hashing, the hash of the frame must not have changed either, which also
+ * covers producers that do not set a time stamp (i.e., 0).
+ */
+class DuplicateFrameDetector {
+   private:
+    DuplicateFrameDetector(const DuplicateFrameDetector &) = delete;
+    DuplicateFrameDetector(DuplicateFrameDetector &&)      = delete;
+    DuplicateFrameDetector &operator=(const DuplicateFrameDetector &) = delete;
+    DuplicateFrameDetector &operator=(DuplicateFrameDetector &&) = delete;
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param hashing true if duplicate() is given the hash of every frame.
+     */
+    explicit DuplicateFrameDetector(bool hashing) noexcept
+        : m_hashing{hashing} {}
+
+    /**
+     * @return true if duplicate() needs the hash of the frame.
+     */
+    bool hashing() const noexcept {
+        return m_hashing;
+    }
+
+    /**
+     * @param sampleTimeStamp Time stamp of the frame in microseconds as set by the producer or 0.
+     * @param hash Hash of the frame's content when hashing.
+     * @return true if the frame is a duplicate of the previous one.
+     */
+    bool duplicate(int64_t sampleTimeStamp, uint32_t hash) noexcept {
+        const bool SAME_TIME_STAMP{m_initialized && (sampleTimeStamp == m_lastTimeStamp)};
+        const bool SAME_HASH{m_initialized && (hash == m_lastHash)};
+        const bool retVal{m_hashing ? (SAME_HASH && SAME_TIME_STAMP) : (SAME_TIME_STAMP && (0 != sampleTimeStamp))};
+        m_initialized = true;
+        m_lastTimeStamp = sampleTimeStamp;
+        m_lastHash = hash;
+        m_duplicates += (retVal ? 1 : 0);
+        return retVal;
+    }
+
+    /**
+     * @return Number of duplicates so far.
+     */
+    uint64_t duplicates() const noexcept {
+        return m_duplicates;
+    }
+
+   private:
+    const bool m_hashing;
+    bool m_initialized{false};
+    int64_t m_lastTimeStamp{0};
+    uint32_t m_lastHash{0};
+    uint64_t m_duplicates{0};
+};
+
+#endif
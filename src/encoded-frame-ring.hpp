@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENCODED_FRAME_RING_HPP
+#define ENCODED_FRAME_RING_HPP
+
+#include "cluon-complete.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+
+/**
+ * Layout of a ring of encoded frames in a shared memory area: a RingHeader
+ * followed by numberOfSlots slots of slotSize bytes, each starting with a
+ * RingSlot that is followed by the frame. Frame n is written into slot
+ * n % numberOfSlots by a single writer; every slot is guarded by a sequence
+ * number that is odd while the slot is written and 2 * (n + 1) once frame n
+ * is complete, so that any number of readers can read frames in place and
+ * check afterwards whether the frame was overwritten in the meantime.
+ */
+struct RingHeader {
+    static constexpr uint32_t MAGIC{0x52585056};  // "VPXR"
+    static constexpr uint32_t VERSION{1};
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t numberOfSlots;
+    uint32_t slotSize;
+    std::atomic<uint64_t> written;  // Number of frames written so far.
+    char padding[40];
+};
+
+struct RingSlot {
+    std::atomic<uint64_t> sequence;
+    int64_t sampleTimeStamp;  // Microseconds since epoch.
+    int64_t pts;              // Presentation time stamp in microseconds.
+    uint32_t senderStamp;
+    char fourcc[4];           // "VP80" or "VP90".
+    uint32_t width;
+    uint32_t height;
+    uint32_t size;            // Bytes of the frame following this slot header.
+    uint8_t keyFrame;
+    uint8_t spatialLayer;
+    uint8_t temporalLayer;
+    uint8_t reserved;
+    char padding[16];
+};
+
+/**
+ * This class writes encoded frames into a ring in a newly created shared
+ * memory area and notifies waiting readers after every frame. It is only
+ * allowed to be used from one thread.
+ */
+class EncodedFrameRing {
+   private:
+    EncodedFrameRing(const EncodedFrameRing &) = delete;
+    EncodedFrameRing(EncodedFrameRing &&)      = delete;
+    EncodedFrameRing &operator=(const EncodedFrameRing &) = delete;
+    EncodedFrameRing &operator=(EncodedFrameRing &&) = delete;
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param name Name of the shared memory area to create.
+     * @param numberOfSlots Number of frames in the ring.
+     * @param maxFrameSize Size of the largest frame to hold.
+     */
+    EncodedFrameRing(const std::string &name, uint32_t numberOfSlots, uint32_t maxFrameSize) noexcept
+        : m_numberOfSlots{numberOfSlots}
+        , m_slotSize{(static_cast<uint32_t>(sizeof(RingSlot)) + maxFrameSize + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT}
+        , m_sharedMemory{new cluon::SharedMemory{name, static_cast<uint32_t>(sizeof(RingHeader)) + m_numberOfSlots * m_slotSize}} {
+        if (valid()) {
+            RingHeader *header{reinterpret_cast<RingHeader*>(m_sharedMemory->data())};
+            header->magic = RingHeader::MAGIC;
+            header->version = RingHeader::VERSION;
+            header->numberOfSlots = m_numberOfSlots;
+            header->slotSize = m_slotSize;
+            header->written.store(0, std::memory_order_release);
+        }
+    }
+
+    /**
+     * @return true if the shared memory area could be created.
+     */
+    bool valid() const noexcept {
+        return (0 < m_numberOfSlots) && m_sharedMemory && m_sharedMemory->valid();
+    }
+
+    /**
+     * This method writes a frame into the next slot; the fields of slot
+     * except for the sequence number and the size describe the frame.
+     *
+     * @param slot Description of the frame.
+     * @param data Frame to write.
+     * @param size Size of the frame.
+     * @return true if the frame fits into a slot.
+     */
+    bool write(const RingSlot &slot, const char *data, uint32_t size) noexcept {
+        if (sizeof(RingSlot) + size > m_slotSize) {
+            m_framesDropped++;
+            return false;
+        }
+        RingHeader *header{reinterpret_cast<RingHeader*>(m_sharedMemory->data())};
+        RingSlot *s{reinterpret_cast<RingSlot*>(m_sharedMemory->data() + sizeof(RingHeader) + (m_written % m_numberOfSlots) * m_slotSize)};
+        s->sequence.store(2 * m_written + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        s->sampleTimeStamp = slot.sampleTimeStamp;
+        s->pts = slot.pts;
+        s->senderStamp = slot.senderStamp;
+        std::memcpy(s->fourcc, slot.fourcc, sizeof(s->fourcc));
+        s->width = slot.width;
+        s->height = slot.height;
+        s->size = size;
+        s->keyFrame = slot.keyFrame;
+        s->spatialLayer = slot.spatialLayer;
+        s->temporalLayer = slot.temporalLayer;
+        std::memcpy(reinterpret_cast<char*>(s) + sizeof(RingSlot), data, size);
+        s->sequence.store(2 * (m_written + 1), std::memory_order_release);
+
+        m_written++;
+        header->written.store(m_written, std::memory_order_release);
+        m_sharedMemory->notifyAll();
+        return true;
+    }
+
+    /**
+     * @return Number of frames that were too large for a slot.
+     */
+    uint64_t framesDropped() const noexcept {
+        return m_framesDropped;
+    }
+
+   private:
+    static constexpr uint32_t ALIGNMENT{64};
+
+    const uint32_t m_numberOfSlots;
+    const uint32_t m_slotSize;
+    std::unique_ptr<cluon::SharedMemory> m_sharedMemory;
+    uint64_t m_written{0};
+    uint64_t m_framesDropped{0};
+};
+
+/**
+ * This class reads encoded frames in place from a ring written by an
+ * EncodedFrameRing in another process.
+ *
+ * Example:
+ * @code
+ * EncodedFrameRingReader ring{"video0.vpx"};
+ * uint64_t next{ring.written()};
+ * while (ring.valid()) {
+ *     ring.wait();
+ *     for (; next < ring.written(); next++) {
+ *         const RingSlot *slot{nullptr};
+ *         const char *data{nullptr};
+ *         if (ring.frame(next, slot, data)) {
+ *             decode(data, slot->size);
+ *             if (!ring.intact(next)) {
+ *                 // Overwritten while decoding; the reader is too slow.
+ *             }
+ *         }
+ *     }
+ * }
+ * @endcode
+ */
+class EncodedFrameRingReader {
+   private:
+    EncodedFrameRingReader(const EncodedFrameRingReader &) = delete;
+    EncodedFrameRingReader(EncodedFrameRingReader &&)      = delete;
+    EncodedFrameRingReader &operator=(const EncodedFrameRingReader &) = delete;
+    EncodedFrameRingReader &operator=(EncodedFrameRingReader &&) = delete;
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param name Name of the shared memory area to attach to.
+     */
+    explicit EncodedFrameRingReader(const std::string &name) noexcept
+        : m_sharedMemory{new cluon::SharedMemory{name}} {}
+
+    /**
+     * @return true if the shared memory area holds a ring.
+     */
+    bool valid() const noexcept {
+        return m_sharedMemory && m_sharedMemory->valid() && (sizeof(RingHeader) <= m_sharedMemory->size())
+               && (RingHeader::MAGIC == header()->magic) && (RingHeader::VERSION == header()->version);
+    }
+
+    /**
+     * This method waits until the writer notifies the next frame.
+     */
+    void wait() noexcept {
+        m_sharedMemory->wait();
+    }
+
+    /**
+     * @return Number of frames written so far.
+     */
+    uint64_t written() const noexcept {
+        return header()->written.load(std::memory_order_acquire);
+    }
+
+    /**
+     * This method points to a frame in place.
+     *
+     * @param number Number of the frame.
+     * @param slot Description of the frame.
+     * @param data Frame of slot->size bytes.
+     * @return true if the frame is complete and not overwritten yet.
+     */
+    bool frame(uint64_t number, const RingSlot *&slot, const char *&data) const noexcept {
+        const RingSlot *s{slotOf(number)};
+        if (2 * (number + 1) != s->sequence.load(std::memory_order_acquire)) {
+            return false;
+        }
+        slot = s;
+        data = reinterpret_cast<const char*>(s) + sizeof(RingSlot);
+        return true;
+    }
+
+    /**
+     * @param number Number of a frame that was read.
+     * @return true if the frame was not overwritten while it was read.
+     */
+    bool intact(uint64_t number) const noexcept {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return 2 * (number + 1) == slotOf(number)->sequence.load(std::memory_order_relaxed);
+    }
+
+   private:
+    const RingHeader *header() const noexcept {
+        return reinterpret_cast<const RingHeader*>(m_sharedMemory->data());
+    }
+
+    const RingSlot *slotOf(uint64_t number) const noexcept {
+        return reinterpret_cast<const RingSlot*>(m_sharedMemory->data() + sizeof(RingHeader) + (number % header()->numberOfSlots) * header()->slotSize);
+    }
+
+   private:
+    std::unique_ptr<cluon::SharedMemory> m_sharedMemory;
+};
+
+#endif
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENCODED_FRAME_HPP
+#define ENCODED_FRAME_HPP
+
+#include "cluon-complete.hpp"
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * This struct holds one encoded VP8 or VP9 frame together with its meta data.
+ * The buffer is allocated once and reused for all subsequent frames.
+ */
+struct EncodedFrame {
+    std::vector<char> data{};
+    // Points either into data or into the output buffer of libvpx, which
+    // remains valid until the next call to vpx_codec_encode.
+    const char *payload{nullptr};
+    uint32_t size{0};
+    cluon::data::TimeStamp sampleTimeStamp{};
+    int64_t pts{0};  // Presentation time stamp in microseconds.
+    bool keyFrame{false};
+    uint32_t temporalLayer{0};
+
+    // Target bitrate and frame interval in microseconds at encoding for pacing.
+    uint32_t bitrate{0};
+    int64_t frameInterval{0};
+
+    // Timing information for --verbose.
+    int64_t lockDuration{0};
+    int64_t encodingDuration{0};
+};
+
+#endif
@@ -0,0 +1,374 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENVELOPE_SENDER_HPP
+#define ENVELOPE_SENDER_HPP
+
+#include "cluon-complete.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+
+/**
+ * This class writes fields in Protobuf format as produced by cluon::ToProtoVisitor
+ * into a caller-provided buffer without allocating memory.
+ */
+class ProtoWriter {
+   private:
+    ProtoWriter(const ProtoWriter &) = delete;
+    ProtoWriter(ProtoWriter &&)      = delete;
+    ProtoWriter &operator=(const ProtoWriter &) = delete;
+    ProtoWriter &operator=(ProtoWriter &&) = delete;
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param buffer Buffer to write to.
+     * @param capacity Size of the buffer.
+     */
+    ProtoWriter(char *buffer, uint32_t capacity) noexcept
+        : m_buffer{buffer}
+        , m_capacity{capacity} {}
+
+    /**
+     * This method writes an unsigned integral field (bool, uint8_t, .., uint64_t).
+     */
+    ProtoWriter &varInt(uint32_t id, uint64_t v) noexcept {
+        key(id, VARINT);
+        return raw(v);
+    }
+
+    /**
+     * This method writes a signed integral field (int8_t, .., int64_t).
+     */
+    ProtoWriter &zigZag(uint32_t id, int64_t v) noexcept {
+        key(id, VARINT);
+        return raw((static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+    }
+
+    /**
+     * This method writes a string or bytes field.
+     */
+    ProtoWriter &bytes(uint32_t id, const char *v, uint32_t length) noexcept {
+        bytesHeader(id, length);
+        if (m_size + length <= m_capacity) {
+            std::memcpy(m_buffer + m_size, v, length);
+        }
+        m_size += length;
+        return *this;
+    }
+
+    /**
+     * This method writes only key and length of a string or bytes field;
+     * the caller is responsible for sending the length bytes thereafter.
+     */
+    ProtoWriter &bytesHeader(uint32_t id, uint32_t length) noexcept {
+        key(id, LENGTH_DELIMITED);
+        return raw(length);
+    }
+
+    /**
+     * This method writes a nested cluon::data::TimeStamp field.
+     */
+    ProtoWriter &timeStamp(uint32_t id, const cluon::data::TimeStamp &ts) noexcept {
+        const uint64_t SECONDS{zigZag32(ts.seconds())};
+        const uint64_t MICROSECONDS{zigZag32(ts.microseconds())};
+        bytesHeader(id, 2 + length(SECONDS) + length(MICROSECONDS));
+        key(1, VARINT);
+        raw(SECONDS);
+        key(2, VARINT);
+        return raw(MICROSECONDS);
+    }
+
+    /**
+     * @return Number of bytes written so far.
+     */
+    uint32_t size() const noexcept {
+        return m_size;
+    }
+
+    /**
+     * @return true if all fields fit into the buffer.
+     */
+    bool good() const noexcept {
+        return m_size <= m_capacity;
+    }
+
+    /**
+     * @return Number of bytes needed to encode v as varint.
+     */
+    static uint32_t length(uint64_t v) noexcept {
+        uint32_t l{1};
+        while (0x7f < v) {
+            v >>= 7;
+            l++;
+        }
+        return l;
+    }
+
+   private:
+    static uint64_t zigZag32(int32_t v) noexcept {
+        return (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31);
+    }
+
+    void key(uint32_t id, uint8_t type) noexcept {
+        raw((id << 3) | type);
+    }
+
+    ProtoWriter &raw(uint64_t v) noexcept {
+        while (0x7f < v) {
+            put(static_cast<char>((v & 0x7f) | 0x80));
+            v >>= 7;
+        }
+        put(static_cast<char>(v));
+        return *this;
+    }
+
+    void put(char c) noexcept {
+        if (m_size < m_capacity) {
+            m_buffer[m_size] = c;
+        }
+        m_size++;
+    }
+
+   private:
+    static constexpr uint8_t VARINT{0};
+    static constexpr uint8_t LENGTH_DELIMITED{2};
+
+    char *m_buffer;
+    uint32_t m_capacity;
+    uint32_t m_size{0};
+};
+
+/**
+ * This class frames a serialized message as Envelope in the format used by
+ * cluon::OD4Session and in .rec files: the OD4 header and the fields preceding
+ * serializedData form the prefix, the fields following it the suffix, so that
+ * the serialized message itself is never copied.
+ */
+class EnvelopeFraming {
+   private:
+    EnvelopeFraming(const EnvelopeFraming &) = delete;
+    EnvelopeFraming(EnvelopeFraming &&)      = delete;
+    EnvelopeFraming &operator=(const EnvelopeFraming &) = delete;
+    EnvelopeFraming &operator=(EnvelopeFraming &&) = delete;
+
+   public:
+    EnvelopeFraming() = default;
+
+    /**
+     * This method frames a serialized message.
+     *
+     * @param dataType Message identifier of the serialized message.
+     * @param serializedSize Size of the serialized message.
+     * @param sent Time point when this Envelope was sent.
+     * @param received Time point when this Envelope was received.
+     * @param sampleTimeStamp Time point when this sample was captured.
+     * @param senderStamp Sender stamp.
+     * @return true if the Envelope's length fits into the OD4 header.
+     */
+    bool frame(int32_t dataType, uint32_t serializedSize, const cluon::data::TimeStamp &sent, const cluon::data::TimeStamp &received, const cluon::data::TimeStamp &sampleTimeStamp, uint32_t senderStamp) noexcept {
+        // Fields following serializedData.
+        ProtoWriter suffix{m_suffix, sizeof(m_suffix)};
+        suffix.timeStamp(3, sent)
+            .timeStamp(4, received)
+            .timeStamp(5, sampleTimeStamp)
+            .varInt(6, senderStamp);
+
+        // OD4 header and fields preceding serializedData.
+        ProtoWriter fields{m_prefix + OD4_HEADER_SIZE, sizeof(m_prefix) - OD4_HEADER_SIZE};
+        fields.zigZag(1, dataType).bytesHeader(2, serializedSize);
+
+        const uint64_t LENGTH{static_cast<uint64_t>(fields.size()) + serializedSize + suffix.size()};
+        if (!fields.good() || !suffix.good() || (MAX_LENGTH < LENGTH)) {
+            return false;
+        }
+        m_prefix[0] = static_cast<char>(0x0D);
+        m_prefix[1] = static_cast<char>(0xA4);
+        m_prefix[2] = static_cast<char>(LENGTH & 0xFF);
+        m_prefix[3] = static_cast<char>((LENGTH >> 8) & 0xFF);
+        m_prefix[4] = static_cast<char>((LENGTH >> 16) & 0xFF);
+        m_prefixSize = OD4_HEADER_SIZE + fields.size();
+        m_suffixSize = suffix.size();
+        m_size = OD4_HEADER_SIZE + static_cast<uint32_t>(LENGTH);
+        return true;
+    }
+
+    /**
+     * @return OD4 header and fields preceding serializedData of the last framed message.
+     */
+    struct iovec prefix() noexcept {
+        struct iovec retVal;
+        retVal.iov_base = m_prefix;
+        retVal.iov_len  = m_prefixSize;
+        return retVal;
+    }
+
+    /**
+     * @return Fields following serializedData of the last framed message.
+     */
+    struct iovec suffix() noexcept {
+        struct iovec retVal;
+        retVal.iov_base = m_suffix;
+        retVal.iov_len  = m_suffixSize;
+        return retVal;
+    }
+
+    /**
+     * @return Size of the last framed Envelope including the OD4 header.
+     */
+    uint32_t size() const noexcept {
+        return m_size;
+    }
+
+   private:
+    static constexpr uint32_t OD4_HEADER_SIZE{5};
+    static constexpr uint64_t MAX_LENGTH{0xFFFFFF};
+
+    char m_prefix[32]{};
+    char m_suffix[64]{};
+    uint32_t m_prefixSize{0};
+    uint32_t m_suffixSize{0};
+    uint32_t m_size{0};
+};
+
+/**
+ * This class sends Envelopes in the same format as cluon::OD4Session; the
+ * serialized message is passed as a list of buffers that are sent together
+ * with the Envelope header in one datagram using scatter-gather I/O so that
+ * neither the payload is copied nor memory is allocated.
+ */
+class EnvelopeSender {
+   private:
+    EnvelopeSender(const EnvelopeSender &) = delete;
+    EnvelopeSender(EnvelopeSender &&)      = delete;
+    EnvelopeSender &operator=(const EnvelopeSender &) = delete;
+    EnvelopeSender &operator=(EnvelopeSender &&) = delete;
+
+   public:
+    // Maximum number of buffers that make up one serialized message.
+    static constexpr uint32_t MAX_PARTS{8};
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param address Numerical IPv4 address to send to (e.g., 225.0.0.111 for CID 111).
+     * @param port Port to send to (12175 for an OD4Session).
+     */
+    EnvelopeSender(const std::string &address, uint16_t port) noexcept
+        : m_sendToAddress() {
+        std::memset(&m_sendToAddress, 0, sizeof(m_sendToAddress));
+        m_sendToAddress.sin_addr.s_addr = ::inet_addr(address.c_str());
+        m_sendToAddress.sin_family      = AF_INET;
+        m_sendToAddress.sin_port        = htons(port);
+
+        m_socket = ::socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (!(m_socket < 0)) {
+            struct sockaddr_in sendFromAddress;
+            std::memset(&sendFromAddress, 0, sizeof(sendFromAddress));
+            sendFromAddress.sin_family = AF_INET;
+            sendFromAddress.sin_port   = 0; // Randomly choose a port to bind.
+            if (0 != ::bind(m_socket, reinterpret_cast<struct sockaddr *>(&sendFromAddress), sizeof(sendFromAddress))) {
+                ::close(m_socket);
+                m_socket = -1;
+            }
+        }
+    }
+
+    ~EnvelopeSender() noexcept {
+        if (!(m_socket < 0)) {
+            ::shutdown(m_socket, SHUT_RDWR);
+            ::close(m_socket);
+        }
+    }
+
+    /**
+     * @return true if the socket could be created.
+     */
+    bool valid() const noexcept {
+        return !(m_socket < 0);
+    }
+
+    /**
+     * This method sends one Envelope.
+     *
+     * @param dataType Message identifier of the serialized message.
+     * @param parts Buffers forming the serialized message (at most MAX_PARTS).
+     * @param numberOfParts Number of buffers.
+     * @param sampleTimeStamp Time point when this sample was captured.
+     * @param senderStamp Sender stamp.
+     * @return (bytes sent, errno) as cluon::UDPSender::send.
+     */
+    std::pair<ssize_t, int32_t> send(int32_t dataType, const struct iovec *parts, uint32_t numberOfParts, const cluon::data::TimeStamp &sampleTimeStamp, uint32_t senderStamp) noexcept {
+        if (m_socket < 0) {
+            return {-1, EBADF};
+        }
+        if (MAX_PARTS < numberOfParts) {
+            return {-1, EINVAL};
+        }
+
+        uint32_t serializedSize{0};
+        for (uint32_t i{0}; i < numberOfParts; i++) {
+            serializedSize += static_cast<uint32_t>(parts[i].iov_len);
+        }
+
+        if (!m_framing.frame(dataType, serializedSize, cluon::time::now(), cluon::data::TimeStamp(), sampleTimeStamp, senderStamp)
+            || (MAX_LENGTH < m_framing.size())) {
+            return {-1, E2BIG};
+        }
+        m_iov[0] = m_framing.prefix();
+        for (uint32_t i{0}; i < numberOfParts; i++) {
+            m_iov[1 + i] = parts[i];
+        }
+        m_iov[1 + numberOfParts] = m_framing.suffix();
+
+        struct msghdr message;
+        std::memset(&message, 0, sizeof(message));
+        message.msg_name    = &m_sendToAddress;
+        message.msg_namelen = sizeof(m_sendToAddress);
+        message.msg_iov     = m_iov;
+        message.msg_iovlen  = 2 + numberOfParts;
+
+        ssize_t bytesSent = ::sendmsg(m_socket, &message, 0);
+        return {bytesSent, (0 > bytesSent ? errno : 0)};
+    }
+
+   private:
+    static constexpr uint32_t MAX_LENGTH{static_cast<uint16_t>(cluon::UDPPacketSizeConstraints::MAX_SIZE_UDP_PACKET)
+                                         - static_cast<uint16_t>(cluon::UDPPacketSizeConstraints::SIZE_IPv4_HEADER)
+                                         - static_cast<uint16_t>(cluon::UDPPacketSizeConstraints::SIZE_UDP_HEADER)};
+
+    int32_t m_socket{-1};
+    struct sockaddr_in m_sendToAddress;
+
+    EnvelopeFraming m_framing{};
+    struct iovec m_iov[MAX_PARTS + 2]{};
+};
+
+#endif
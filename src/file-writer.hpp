@@ -0,0 +1,291 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FILE_WRITER_HPP
+#define FILE_WRITER_HPP
+
+#include "spsc-queue.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * This class writes records into files from a thread of its own so that the
+ * caller never waits for the disk. Records are appended to one of a fixed
+ * number of large, page-aligned buffers; a full buffer is handed to the
+ * writing thread, which writes it with one system call and returns it. When
+ * all buffers are waiting to be written, records are dropped instead of
+ * blocking the caller. Records never span two buffers, so that files can be
+ * rotated by size or age between any two buffers; rotated files are numbered,
+ * e.g., video-0000.rec, video-0001.rec, ... for video.rec. A buffer that was
+ * not handed over for a second is handed over with the next record or, when
+ * the caller has nothing to write, by flushOld(), so that records of slow or
+ * stopped streams reach the disk.
+ */
+class FileWriter {
+   private:
+    FileWriter(const FileWriter &) = delete;
+    FileWriter(FileWriter &&)      = delete;
+    FileWriter &operator=(const FileWriter &) = delete;
+    FileWriter &operator=(FileWriter &&) = delete;
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param filename Name of the file to write.
+     * @param bufferSize Size of a buffer, i.e., of the largest record; rounded up to pages.
+     * @param numberOfBuffers Number of buffers.
+     * @param maxFileSize Size in bytes after which the next file is started or 0.
+     * @param maxFileAge Time after which the next file is started or 0.
+     */
+    FileWriter(const std::string &filename, uint32_t bufferSize, uint32_t numberOfBuffers, uint64_t maxFileSize, std::chrono::seconds maxFileAge) noexcept
+        : m_filename{filename}
+        , m_bufferSize{(bufferSize + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE}
+        , m_maxFileSize{maxFileSize}
+        , m_maxFileAge{maxFileAge}
+        , m_buffers(numberOfBuffers, nullptr)
+        , m_used(numberOfBuffers, 0)
+        , m_freeBuffers{numberOfBuffers}
+        , m_fullBuffers{numberOfBuffers} {
+        bool allocated{0 < numberOfBuffers};
+        for (uint32_t i{0}; i < numberOfBuffers; i++) {
+            void *buffer{nullptr};
+            allocated &= (0 == ::posix_memalign(&buffer, PAGE_SIZE, m_bufferSize));
+            m_buffers[i] = static_cast<char*>(buffer);
+            if (0 < i) {
+                m_freeBuffers.push(i);
+            }
+        }
+        if (allocated && open()) {
+            m_writer = std::thread([this]() { run(); });
+        }
+    }
+
+    ~FileWriter() noexcept {
+        if (m_writer.joinable()) {
+            const std::chrono::milliseconds POLL_INTERVAL{1};
+            while (!flush()) {
+                std::this_thread::sleep_for(POLL_INTERVAL);
+            }
+            m_stop.store(true);
+            m_writer.join();
+        }
+        if (!(m_file < 0)) {
+            ::close(m_file);
+        }
+        for (char *buffer : m_buffers) {
+            std::free(buffer);
+        }
+    }
+
+    /**
+     * @return true if the buffers could be allocated and the first file could be opened.
+     */
+    bool valid() const noexcept {
+        return m_writer.joinable();
+    }
+
+    /**
+     * This method appends a record to the current buffer. It is only allowed
+     * to be called from one thread.
+     *
+     * @param parts Buffers forming the record.
+     * @param numberOfParts Number of buffers.
+     * @return true if the record was accepted; false if it was dropped.
+     */
+    bool write(const struct iovec *parts, uint32_t numberOfParts) noexcept {
+        uint64_t size{0};
+        for (uint32_t i{0}; i < numberOfParts; i++) {
+            size += parts[i].iov_len;
+        }
+        if (m_bufferSize < size) {
+            m_recordsDropped++;
+            return false;
+        }
+        if (m_bufferSize < m_used[m_current] + size) {
+            handOver();
+        }
+        if (m_bufferSize < m_used[m_current] + size) {
+            // No buffer was free to continue with.
+            m_recordsDropped++;
+            return false;
+        }
+
+        char *dst{m_buffers[m_current] + m_used[m_current]};
+        for (uint32_t i{0}; i < numberOfParts; i++) {
+            std::memcpy(dst, parts[i].iov_base, parts[i].iov_len);
+            dst += parts[i].iov_len;
+        }
+        m_used[m_current] += static_cast<uint32_t>(size);
+        flushOld();
+        return true;
+    }
+
+    /**
+     * This method hands the current buffer to the writing thread unless it is
+     * empty. It is only allowed to be called from the thread calling write().
+     *
+     * @return true if the current buffer is empty now.
+     */
+    bool flush() noexcept {
+        handOver();
+        return 0 == m_used[m_current];
+    }
+
+    /**
+     * This method hands the current buffer to the writing thread if it was
+     * not handed over for a second. It is only allowed to be called from the
+     * thread calling write(), e.g., while there is nothing to write.
+     */
+    void flushOld() noexcept {
+        const std::chrono::seconds FLUSH_INTERVAL{1};
+        if (std::chrono::steady_clock::now() - m_lastHandOver > FLUSH_INTERVAL) {
+            handOver();
+        }
+    }
+
+    /**
+     * @return Number of records dropped as no buffer was free or as they were too large.
+     */
+    uint64_t recordsDropped() const noexcept {
+        return m_recordsDropped;
+    }
+
+    /**
+     * @return Number of bytes written to disk so far.
+     */
+    uint64_t bytesWritten() const noexcept {
+        return m_bytesWritten.load(std::memory_order_relaxed);
+    }
+
+   private:
+    // Hands the current buffer to the writing thread if it is not empty and another one is free.
+    void handOver() noexcept {
+        m_lastHandOver = std::chrono::steady_clock::now();
+        uint32_t next{0};
+        if ((0 < m_used[m_current]) && m_freeBuffers.pop(next)) {
+            m_fullBuffers.push(m_current);
+            m_current = next;
+        }
+    }
+
+    // Name of the file to write; numbered when rotating.
+    std::string filename() const noexcept {
+        if ((0 == m_maxFileSize) && (0 == m_maxFileAge.count())) {
+            return m_filename;
+        }
+        const std::size_t DOT{m_filename.rfind('.')};
+        const std::size_t SLASH{m_filename.rfind('/')};
+        const std::size_t POSITION{((std::string::npos != DOT) && ((std::string::npos == SLASH) || (SLASH < DOT))) ? DOT : m_filename.size()};
+        std::stringstream sstr;
+        sstr << m_filename.substr(0, POSITION) << '-' << std::setw(4) << std::setfill('0') << m_fileCounter << m_filename.substr(POSITION);
+        return sstr.str();
+    }
+
+    bool open() noexcept {
+        if (!(m_file < 0)) {
+            ::close(m_file);
+        }
+        m_file = ::open(filename().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        m_fileCounter++;
+        m_fileSize = 0;
+        m_fileOpened = std::chrono::steady_clock::now();
+        return !(m_file < 0);
+    }
+
+    void run() noexcept {
+        const std::chrono::microseconds TIMEOUT{100000};
+        uint32_t index{0};
+        while (true) {
+            // Buffers handed over before stopping are still written.
+            const bool STOP{m_stop.load()};
+            if (!m_fullBuffers.pop(index, TIMEOUT)) {
+                if (STOP) {
+                    break;
+                }
+                continue;
+            }
+            const uint32_t SIZE{m_used[index]};
+            if ((0 < m_fileSize)
+                && (((0 < m_maxFileSize) && (m_maxFileSize < m_fileSize + SIZE))
+                    || ((0 < m_maxFileAge.count()) && (m_maxFileAge <= std::chrono::steady_clock::now() - m_fileOpened)))) {
+                open();
+            }
+            uint32_t written{0};
+            while (!(m_file < 0) && (written < SIZE)) {
+                const ssize_t N{::write(m_file, m_buffers[index] + written, SIZE - written)};
+                if (0 > N) {
+                    if (EINTR == errno) {
+                        continue;
+                    }
+                    break;
+                }
+                written += static_cast<uint32_t>(N);
+            }
+            m_fileSize += written;
+            m_bytesWritten.fetch_add(written, std::memory_order_relaxed);
+            m_used[index] = 0;
+            m_freeBuffers.push(index);
+        }
+    }
+
+   private:
+    static constexpr uint32_t PAGE_SIZE{4096};
+
+    const std::string m_filename;
+    const uint32_t m_bufferSize;
+    const uint64_t m_maxFileSize;
+    const std::chrono::seconds m_maxFileAge;
+
+    // Buffers are handed between the caller and the writing thread by index; the current
+    // buffer belongs to the caller.
+    std::vector<char*> m_buffers;
+    std::vector<uint32_t> m_used;
+    SPSCQueue<uint32_t> m_freeBuffers;  // writer -> caller
+    SPSCQueue<uint32_t> m_fullBuffers;  // caller -> writer
+    uint32_t m_current{0};
+    std::chrono::steady_clock::time_point m_lastHandOver{std::chrono::steady_clock::now()};
+    uint64_t m_recordsDropped{0};
+
+    // Only used by the writing thread after construction.
+    int32_t m_file{-1};
+    uint32_t m_fileCounter{0};
+    uint64_t m_fileSize{0};
+    std::chrono::steady_clock::time_point m_fileOpened{};
+
+    std::atomic<uint64_t> m_bytesWritten{0};
+    std::atomic<bool> m_stop{false};
+    std::thread m_writer{};
+};
+
+#endif
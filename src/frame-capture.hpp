@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_CAPTURE_HPP
+#define FRAME_CAPTURE_HPP
+
+#include "cluon-complete.hpp"
+#include "opendlv-video-message-set.hpp"
+#include "duplicate-frame-detector.hpp"
+#include "source.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * This class waits for the frames of the shared memory areas and takes them
+ * out: it locks the area, reads the sample time stamp, drops duplicates, and,
+ * when copying, transforms the frame into the source's frame pool. Every area
+ * is only captured from by one thread at a time.
+ */
+class FrameCapture {
+   private:
+    FrameCapture(const FrameCapture &) = delete;
+    FrameCapture(FrameCapture &&)      = delete;
+    FrameCapture &operator=(const FrameCapture &) = delete;
+    FrameCapture &operator=(FrameCapture &&) = delete;
+
+   public:
+    /**
+     * Settings of all shared memory areas as given on the command line.
+     */
+    struct Settings {
+        bool copy{false};       // Copy the frames out and unlock the shared memory before encoding.
+        double fps{0.0};        // Fixed output rate; 0 = every notification.
+        bool timedWait{false};  // Wait with a deadline for --fps and --stale-timeout.
+        std::chrono::milliseconds staleTimeout{1000};
+        bool verbose{false};
+    };
+
+    /**
+     * Constructor.
+     *
+     * @param settings Settings of all shared memory areas.
+     * @param sources Shared memory areas to capture from.
+     * @param delegate Called with the SourceStatus of a shared memory area and its index when the area becomes stale or delivers frames again.
+     */
+    FrameCapture(const Settings &settings, std::vector<std::unique_ptr<Source> > &sources, std::function<void(opendlv::video::SourceStatus &, uint32_t)> delegate) noexcept
+        : m_settings{settings}
+        , m_sources{sources}
+        , m_delegate{std::move(delegate)}
+        , m_outputInterval{std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>((0 < settings.fps) ? 1.0 / settings.fps : 0.0))} {}
+
+    /**
+     * This method waits for the next frame of the given shared memory area: either
+     * for the next notification or, with --fps, for the next tick of the output
+     * clock, where the shared memory holds the newest frame and older ones are
+     * skipped. While no frame arrives for --stale-timeout, the area is reported as
+     * stale once per timeout.
+     *
+     * @param index Index of the shared memory area.
+     * @return true if there is a frame to capture.
+     */
+    bool awaitFrame(uint32_t index) noexcept {
+        Source &source{*m_sources[index]};
+        if (!m_settings.timedWait) {
+            // Returns every second without a frame so that the loops can flush their outputs.
+            return source.waiter->waitUntil(std::chrono::steady_clock::now() + std::chrono::seconds(1));
+        }
+
+        bool newFrame{false};
+        if (0 < m_settings.fps) {
+            std::this_thread::sleep_until(source.nextTick);
+            newFrame = source.waiter->waitUntil(source.nextTick);
+            // Skip ticks when falling behind instead of catching up.
+            source.nextTick = std::max(source.nextTick + m_outputInterval, std::chrono::steady_clock::now());
+        }
+        else {
+            newFrame = source.waiter->waitUntil(std::chrono::steady_clock::now() + m_settings.staleTimeout);
+        }
+
+        const auto NOW{std::chrono::steady_clock::now()};
+        const uint32_t SINCE_LAST_FRAME{static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(NOW - source.lastFrame).count())};
+        const bool REPORT{newFrame ? source.stale : ((m_settings.staleTimeout <= NOW - source.lastFrame) && (m_settings.staleTimeout <= NOW - source.lastStaleReport))};
+        if (REPORT) {
+            source.stale = !newFrame;
+            source.lastStaleReport = NOW;
+            opendlv::video::SourceStatus status;
+            status.stale(source.stale).millisecondsSinceLastFrame(SINCE_LAST_FRAME);
+            if (m_delegate) {
+                m_delegate(status, index);
+            }
+            std::clog << "[opendlv-video-vpx-encoder]: '" << source.sharedMemory->name() << "' " << (source.stale ? "is stale; last frame " : "delivers frames again after ") << SINCE_LAST_FRAME << " ms." << std::endl;
+        }
+        if (newFrame) {
+            source.lastFrame = NOW;
+        }
+        return newFrame;
+    }
+
+    /**
+     * This method locks the shared memory and reads the sample time stamp. With
+     * --copy-out, the frame is copied or converted into the frame pool at c.index
+     * and the shared memory is unlocked again; otherwise, the caller needs to
+     * unlock the shared memory after encoding.
+     *
+     * @param source Shared memory area to capture from.
+     * @param c Captured frame.
+     * @return false, with the shared memory unlocked, if the frame was already captured.
+     */
+    bool capture(Source &source, CapturedFrame &c) noexcept {
+        c.sampleTimeStamp = cluon::time::now();
+
+        cluon::SharedMemory *sharedMemory{source.sharedMemory.get()};
+        sharedMemory->lock();
+        if (m_settings.verbose) {
+            c.locked = cluon::time::now();
+        }
+        {
+            // Read notification timestamp.
+            auto r = sharedMemory->getTimeStamp();
+            c.sampleTimeStamp = (r.first ? r.second : c.sampleTimeStamp);
+
+            // Notifications without new content are dropped before copying the frame.
+            DuplicateFrameDetector &duplicates{*source.duplicates};
+            const uint32_t HASH{duplicates.hashing() ? source.input.hash(sharedMemory->data()) : 0};
+            if (duplicates.duplicate((r.first ? cluon::time::toMicroseconds(r.second) : 0), HASH)) {
+                sharedMemory->unlock();
+                if (m_settings.verbose) {
+                    std::clog << "[opendlv-video-vpx-encoder]: Skipping duplicate frame from '" << sharedMemory->name() << "' (" << duplicates.duplicates() << " in total)." << std::endl;
+                }
+                return false;
+            }
+        }
+        if (m_settings.copy) {
+            source.transform.apply(sharedMemory->data(), source.input, source.framePool.frame(c.index));
+            sharedMemory->unlock();
+            if (m_settings.verbose) {
+                c.unlocked = cluon::time::now();
+            }
+        }
+        c.unchanged = source.detector && source.detector->unchanged(m_settings.copy ? source.framePool.frame(c.index) : &source.yuvFrame);
+        return true;
+    }
+
+   private:
+    const Settings m_settings;
+    std::vector<std::unique_ptr<Source> > &m_sources;
+    std::function<void(opendlv::video::SourceStatus &, uint32_t)> m_delegate;
+    const std::chrono::steady_clock::duration m_outputInterval;
+};
+
+#endif
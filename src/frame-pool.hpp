@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_POOL_HPP
+#define FRAME_POOL_HPP
+
+#include <vpx/vpx_image.h>
+#include <libyuv.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * This class holds a small number of preallocated I420 frames with
+ * aligned strides. It is used to copy a frame out of the shared memory
+ * area so that the shared memory can be unlocked before encoding; frames
+ * are copied or converted into it with FrameTransform.
+ *
+ * Frames can be handed to several consumer threads: one thread acquires
+ * a frame for a given number of users and every user releases it again.
+ */
+class FramePool {
+   private:
+    FramePool(const FramePool &) = delete;
+    FramePool(FramePool &&)      = delete;
+    FramePool &operator=(const FramePool &) = delete;
+    FramePool &operator=(FramePool &&) = delete;
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param width Width of the frames.
+     * @param height Height of the frames.
+     * @param size Number of frames to preallocate.
+     */
+    FramePool(uint32_t width, uint32_t height, uint32_t size) noexcept
+        : m_frames(size, nullptr)
+        , m_users(new std::atomic<uint32_t>[size]) {
+        for (auto &f : m_frames) {
+            // Align every row to 32 bytes to suit the SIMD copy routines.
+            f = vpx_img_alloc(nullptr, VPX_IMG_FMT_I420, width, height, ALIGNMENT);
+        }
+        for (uint32_t i{0}; i < size; i++) {
+            m_users[i].store(0);
+        }
+    }
+
+    ~FramePool() noexcept {
+        for (auto f : m_frames) {
+            if (nullptr != f) {
+                vpx_img_free(f);
+            }
+        }
+    }
+
+    /**
+     * @return true if all frames could be allocated.
+     */
+    bool valid() const noexcept {
+        bool retVal{!m_frames.empty()};
+        for (auto f : m_frames) {
+            retVal &= (nullptr != f);
+        }
+        return retVal;
+    }
+
+    /**
+     * @return Number of frames in this pool.
+     */
+    uint32_t size() const noexcept {
+        return static_cast<uint32_t>(m_frames.size());
+    }
+
+    /**
+     * @param index Index of the frame [0 .. size()).
+     * @return Frame at the given index.
+     */
+    vpx_image_t *frame(uint32_t index) noexcept {
+        return m_frames[index];
+    }
+
+    /**
+     * This method is only allowed to be called from one thread.
+     *
+     * @param index Index of a frame that is not in use.
+     * @param users Number of users that will release the frame.
+     * @return true if an unused frame was found.
+     */
+    bool acquire(uint32_t &index, uint32_t users) noexcept {
+        for (uint32_t i{0}; i < size(); i++) {
+            if (0 == m_users[i].load(std::memory_order_acquire)) {
+                m_users[i].store(users, std::memory_order_release);
+                index = i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @param index Index of a frame that is not used by the caller anymore.
+     */
+    void release(uint32_t index) noexcept {
+        release(index, 1);
+    }
+
+    /**
+     * @param index Index of a frame that is not used by the given number of users anymore.
+     * @param users Number of users that release the frame.
+     */
+    void release(uint32_t index, uint32_t users) noexcept {
+        m_users[index].fetch_sub(users, std::memory_order_acq_rel);
+    }
+
+    /**
+     * This method scales an I420 frame to the dimensions of another one.
+     *
+     * @param src Frame to scale.
+     * @param dst Frame to scale into; its dimensions define the target size.
+     * @param filter Filter to trade quality for speed.
+     */
+    static void scaleI420(const vpx_image_t *src, vpx_image_t *dst, libyuv::FilterMode filter) noexcept {
+        libyuv::I420Scale(src->planes[VPX_PLANE_Y], src->stride[VPX_PLANE_Y],
+                          src->planes[VPX_PLANE_U], src->stride[VPX_PLANE_U],
+                          src->planes[VPX_PLANE_V], src->stride[VPX_PLANE_V],
+                          static_cast<int32_t>(src->d_w), static_cast<int32_t>(src->d_h),
+                          dst->planes[VPX_PLANE_Y], dst->stride[VPX_PLANE_Y],
+                          dst->planes[VPX_PLANE_U], dst->stride[VPX_PLANE_U],
+                          dst->planes[VPX_PLANE_V], dst->stride[VPX_PLANE_V],
+                          static_cast<int32_t>(dst->d_w), static_cast<int32_t>(dst->d_h),
+                          filter);
+    }
+
+   private:
+    static constexpr uint32_t ALIGNMENT{32};
+
+    std::vector<vpx_image_t*> m_frames;
+    std::unique_ptr<std::atomic<uint32_t>[]> m_users;
+};
+
+#endif
@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_TRANSFORM_HPP
+#define FRAME_TRANSFORM_HPP
+
+#include "frame-pool.hpp"
+#include "input-format.hpp"
+
+#include <vpx/vpx_image.h>
+#include <libyuv.h>
+
+#include <cstdint>
+
+/**
+ * This class copies a frame out of a shared memory area while cropping,
+ * converting, scaling, rotating, and mirroring it with libyuv. Cropping
+ * only moves the start of the rows; every other step reads the frame once,
+ * so that a frame is touched once when only one of them is needed and I420
+ * frames are scaled or rotated straight from the shared memory. Otherwise,
+ * the steps write into preallocated intermediate frames: conversion first,
+ * then scaling (which reduces the pixels for the rest), then orientation.
+ */
+class FrameTransform {
+   private:
+    FrameTransform(const FrameTransform &) = delete;
+    FrameTransform(FrameTransform &&)      = delete;
+    FrameTransform &operator=(const FrameTransform &) = delete;
+    FrameTransform &operator=(FrameTransform &&) = delete;
+
+   public:
+    /**
+     * Geometry of the transform; sizes of 0 keep the size of the previous step.
+     */
+    struct Geometry {
+        uint32_t cropX{0};
+        uint32_t cropY{0};
+        uint32_t cropWidth{0};
+        uint32_t cropHeight{0};
+        uint32_t width{0};   // Width after rotation.
+        uint32_t height{0};  // Height after rotation.
+        libyuv::FilterMode filter{libyuv::kFilterBox};
+        uint32_t rotation{0};  // 0, 90, 180, or 270 degrees clockwise.
+        bool mirror{false};    // Mirror horizontally before rotating.
+    };
+
+    /**
+     * Constructor.
+     *
+     * @param input Layout of the frames in the shared memory.
+     * @param inputWidth Width of the frames in the shared memory.
+     * @param inputHeight Height of the frames in the shared memory.
+     * @param geometry Crop, scale, rotation, and mirroring.
+     */
+    FrameTransform(const InputFormat &input, uint32_t inputWidth, uint32_t inputHeight, const Geometry &geometry) noexcept
+        : m_inputWidth{inputWidth}
+        , m_inputHeight{inputHeight}
+        , m_cropX{geometry.cropX}
+        , m_cropY{geometry.cropY}
+        , m_cropWidth{(0 < geometry.cropWidth) ? geometry.cropWidth : inputWidth}
+        , m_cropHeight{(0 < geometry.cropHeight) ? geometry.cropHeight : inputHeight}
+        , m_width{(0 < geometry.width) ? geometry.width : (isTransposed(geometry.rotation) ? m_cropHeight : m_cropWidth)}
+        , m_height{(0 < geometry.height) ? geometry.height : (isTransposed(geometry.rotation) ? m_cropWidth : m_cropHeight)}
+        , m_filter{geometry.filter}
+        , m_rotation{geometry.rotation}
+        , m_mirror{geometry.mirror}
+        , m_convert{InputFormat::I420 != input.format()}
+        , m_converted{m_cropWidth, m_cropHeight, (m_convert && (scaled() || oriented())) ? 1u : 0u}
+        , m_scaled{scaledWidth(), scaledHeight(), (scaled() && oriented()) ? 1u : 0u}
+        , m_mirrored{scaledWidth(), scaledHeight(), (m_mirror && isTransposed(m_rotation)) ? 1u : 0u} {}
+
+    /**
+     * @return true if the geometry fits into the frames and all intermediate frames could be allocated.
+     */
+    bool valid() const noexcept {
+        return (0 == m_cropX % 2) && (0 == m_cropY % 2)
+               && (m_cropX + m_cropWidth <= m_inputWidth) && (m_cropY + m_cropHeight <= m_inputHeight)
+               && (0 < m_width) && (0 < m_height)
+               && ((0 == m_rotation) || (90 == m_rotation) || (180 == m_rotation) || (270 == m_rotation))
+               && (m_converted.valid() || (0 == m_converted.size()))
+               && (m_scaled.valid() || (0 == m_scaled.size()))
+               && (m_mirrored.valid() || (0 == m_mirrored.size()));
+    }
+
+    /**
+     * @return true if the frame is only copied.
+     */
+    bool identity() const noexcept {
+        return (m_cropWidth == m_inputWidth) && (m_cropHeight == m_inputHeight) && !scaled() && !oriented();
+    }
+
+    /**
+     * @return Width of the transformed frame.
+     */
+    uint32_t width() const noexcept {
+        return m_width;
+    }
+
+    /**
+     * @return Height of the transformed frame.
+     */
+    uint32_t height() const noexcept {
+        return m_height;
+    }
+
+    /**
+     * @return Filter used for scaling.
+     */
+    libyuv::FilterMode filter() const noexcept {
+        return m_filter;
+    }
+
+    /**
+     * This method transforms a frame into an I420 image.
+     *
+     * @param src Pointer to the frame in the shared memory.
+     * @param input Layout of the frame.
+     * @param dst I420 image of width() x height() to write into.
+     */
+    void apply(const char *src, const InputFormat &input, vpx_image_t *dst) noexcept {
+        vpx_image_t view;
+        vpx_image_t *frame{&view};
+        if (!m_convert && input.wrap(src, &view)) {
+            view.planes[VPX_PLANE_Y] += m_cropY * static_cast<uint32_t>(view.stride[VPX_PLANE_Y]) + m_cropX;
+            view.planes[VPX_PLANE_U] += (m_cropY / 2) * static_cast<uint32_t>(view.stride[VPX_PLANE_U]) + m_cropX / 2;
+            view.planes[VPX_PLANE_V] += (m_cropY / 2) * static_cast<uint32_t>(view.stride[VPX_PLANE_V]) + m_cropX / 2;
+            view.d_w = m_cropWidth;
+            view.d_h = m_cropHeight;
+        }
+        else {
+            frame = (scaled() || oriented()) ? m_converted.frame(0) : dst;
+            input.convert(src, m_cropX, m_cropY, frame);
+        }
+
+        if (scaled()) {
+            vpx_image_t *target{oriented() ? m_scaled.frame(0) : dst};
+            FramePool::scaleI420(frame, target, m_filter);
+            frame = target;
+        }
+
+        if (oriented()) {
+            orient(frame, dst);
+        }
+        else if (&view == frame) {
+            copy(frame, dst, static_cast<int32_t>(frame->d_h));
+        }
+    }
+
+   private:
+    static bool isTransposed(uint32_t rotation) noexcept {
+        return (90 == rotation) || (270 == rotation);
+    }
+
+    bool oriented() const noexcept {
+        return (0 != m_rotation) || m_mirror;
+    }
+
+    // Size after scaling and before rotating.
+    uint32_t scaledWidth() const noexcept {
+        return isTransposed(m_rotation) ? m_height : m_width;
+    }
+    uint32_t scaledHeight() const noexcept {
+        return isTransposed(m_rotation) ? m_width : m_height;
+    }
+
+    bool scaled() const noexcept {
+        return (scaledWidth() != m_cropWidth) || (scaledHeight() != m_cropHeight);
+    }
+
+    // Copies an I420 frame; a negative height flips it vertically.
+    static void copy(const vpx_image_t *src, vpx_image_t *dst, int32_t height) noexcept {
+        libyuv::I420Copy(src->planes[VPX_PLANE_Y], src->stride[VPX_PLANE_Y],
+                         src->planes[VPX_PLANE_U], src->stride[VPX_PLANE_U],
+                         src->planes[VPX_PLANE_V], src->stride[VPX_PLANE_V],
+                         dst->planes[VPX_PLANE_Y], dst->stride[VPX_PLANE_Y],
+                         dst->planes[VPX_PLANE_U], dst->stride[VPX_PLANE_U],
+                         dst->planes[VPX_PLANE_V], dst->stride[VPX_PLANE_V],
+                         static_cast<int32_t>(src->d_w), height);
+    }
+
+    // Mirroring and rotating by 180 degrees is a vertical flip, which libyuv does while copying.
+    void orient(const vpx_image_t *src, vpx_image_t *dst) noexcept {
+        if (m_mirror && (180 == m_rotation)) {
+            copy(src, dst, -static_cast<int32_t>(src->d_h));
+            return;
+        }
+        if (m_mirror) {
+            vpx_image_t *target{(0 == m_rotation) ? dst : m_mirrored.frame(0)};
+            libyuv::I420Mirror(src->planes[VPX_PLANE_Y], src->stride[VPX_PLANE_Y],
+                               src->planes[VPX_PLANE_U], src->stride[VPX_PLANE_U],
+                               src->planes[VPX_PLANE_V], src->stride[VPX_PLANE_V],
+                               target->planes[VPX_PLANE_Y], target->stride[VPX_PLANE_Y],
+                               target->planes[VPX_PLANE_U], target->stride[VPX_PLANE_U],
+                               target->planes[VPX_PLANE_V], target->stride[VPX_PLANE_V],
+                               static_cast<int32_t>(src->d_w), static_cast<int32_t>(src->d_h));
+            src = target;
+        }
+        if (0 != m_rotation) {
+            libyuv::I420Rotate(src->planes[VPX_PLANE_Y], src->stride[VPX_PLANE_Y],
+                               src->planes[VPX_PLANE_U], src->stride[VPX_PLANE_U],
+                               src->planes[VPX_PLANE_V], src->stride[VPX_PLANE_V],
+                               dst->planes[VPX_PLANE_Y], dst->stride[VPX_PLANE_Y],
+                               dst->planes[VPX_PLANE_U], dst->stride[VPX_PLANE_U],
+                               dst->planes[VPX_PLANE_V], dst->stride[VPX_PLANE_V],
+                               static_cast<int32_t>(src->d_w), static_cast<int32_t>(src->d_h),
+                               static_cast<libyuv::RotationMode>(m_rotation));
+        }
+    }
+
+   private:
+    const uint32_t m_inputWidth;
+    const uint32_t m_inputHeight;
+    const uint32_t m_cropX;
+    const uint32_t m_cropY;
+    const uint32_t m_cropWidth;
+    const uint32_t m_cropHeight;
+    const uint32_t m_width;
+    const uint32_t m_height;
+    const libyuv::FilterMode m_filter;
+    const uint32_t m_rotation;
+    const bool m_mirror;
+    const bool m_convert;
+    FramePool m_converted;  // Only allocated when converting before scaling or orienting.
+    FramePool m_scaled;     // Only allocated when scaling before orienting.
+    FramePool m_mirrored;   // Only allocated when mirroring before rotating by 90 or 270 degrees.
+};
+
+#endif
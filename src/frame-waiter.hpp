@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_WAITER_HPP
+#define FRAME_WAITER_HPP
+
+#include "cluon-complete.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/**
+ * This class adds a timeout to cluon::SharedMemory::wait(), which blocks
+ * until the next notification. A thread of its own waits for the
+ * notifications of the shared memory area and counts them so that callers
+ * can wait for a notification with a deadline or check at a given time
+ * whether a frame arrived since they last looked. A waiting caller can be
+ * interrupted, e.g., when stopping, without notifying the shared memory area,
+ * which would wake all other processes waiting for it.
+ *
+ * As a blocked wait() cannot be interrupted, the thread is detached and
+ * ends after the next notification once this object is destroyed; it
+ * shares the ownership of the shared memory area until then.
+ */
+class FrameWaiter {
+   private:
+    FrameWaiter(const FrameWaiter &) = delete;
+    FrameWaiter(FrameWaiter &&)      = delete;
+    FrameWaiter &operator=(const FrameWaiter &) = delete;
+    FrameWaiter &operator=(FrameWaiter &&) = delete;
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param sharedMemory Shared memory area to wait for.
+     */
+    explicit FrameWaiter(std::shared_ptr<cluon::SharedMemory> sharedMemory) noexcept
+        : m_state{std::make_shared<State>()} {
+        std::shared_ptr<State> state{m_state};
+        std::thread([state, sharedMemory]() {
+            while (!state->stop.load() && sharedMemory->valid()) {
+                sharedMemory->wait();
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    state->notifications++;
+                }
+                state->condition.notify_all();
+            }
+        }).detach();
+    }
+
+    ~FrameWaiter() noexcept {
+        m_state->stop.store(true);
+    }
+
+    /**
+     * This method waits until a notification arrived that was not seen
+     * before or until the deadline; for a deadline in the past, it only
+     * checks for such a notification. After interrupt(), it returns at once.
+     *
+     * @param deadline Time point until which to wait at most.
+     * @return true if a notification arrived.
+     */
+    bool waitUntil(const std::chrono::steady_clock::time_point &deadline) noexcept {
+        std::unique_lock<std::mutex> lock(m_state->mutex);
+        const bool retVal{m_state->condition.wait_until(lock, deadline, [this]() { return m_state->interrupted || (m_seen != m_state->notifications); })};
+        m_seen = m_state->notifications;
+        return retVal && !m_state->interrupted;
+    }
+
+    /**
+     * This method ends the current and all following waits of this process
+     * for the shared memory area; it can be called from any thread.
+     */
+    void interrupt() noexcept {
+        {
+            std::lock_guard<std::mutex> lock(m_state->mutex);
+            m_state->interrupted = true;
+        }
+        m_state->condition.notify_all();
+    }
+
+   private:
+    struct State {
+        std::atomic<bool> stop{false};
+        std::mutex mutex{};
+        std::condition_variable condition{};
+        uint64_t notifications{0};
+        bool interrupted{false};
+    };
+
+    std::shared_ptr<State> m_state;
+    uint64_t m_seen{0};
+};
+
+#endif
@@ -0,0 +1,495 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IMAGE_READING_FRAGMENTS_HPP
+#define IMAGE_READING_FRAGMENTS_HPP
+
+#include "cluon-complete.hpp"
+#include "opendlv-video-message-set.hpp"
+#include "envelope-sender.hpp"
+#include "pacer.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * This class sends serialized messages using an EnvelopeSender; messages whose
+ * Envelope would exceed the given maximum datagram size are split into a
+ * sequence of opendlv::video::ImageReadingFragment messages. The message is
+ * not copied.
+ *
+ * Optionally, the fragments are protected by forward error correction: they
+ * are interleaved into groups of (at most) the given size, i.e., fragment i
+ * belongs to group i % n for n groups, and the XOR parity of every group is
+ * sent after the fragments, so that a Reassembler can restore one lost
+ * fragment per group. As neighbouring fragments belong to different groups,
+ * a burst of up to n lost datagrams is recovered as well. The parity costs
+ * 1/groupSize of the message; only the buffer for the parity is allocated,
+ * once for the largest message.
+ */
+class Fragmenter {
+   private:
+    Fragmenter(const Fragmenter &) = delete;
+    Fragmenter(Fragmenter &&)      = delete;
+    Fragmenter &operator=(const Fragmenter &) = delete;
+    Fragmenter &operator=(Fragmenter &&) = delete;
+
+   public:
+    // Upper bound for the OD4 header, the Envelope fields, and the fragment fields.
+    static constexpr uint32_t OVERHEAD{128};
+    static constexpr uint32_t MAX_DATAGRAM_SIZE{static_cast<uint16_t>(cluon::UDPPacketSizeConstraints::MAX_SIZE_UDP_PACKET)
+                                                - static_cast<uint16_t>(cluon::UDPPacketSizeConstraints::SIZE_IPv4_HEADER)
+                                                - static_cast<uint16_t>(cluon::UDPPacketSizeConstraints::SIZE_UDP_HEADER)};
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param maxDatagramSize Maximum size of a UDP datagram in bytes (OVERHEAD < maxDatagramSize <= MAX_DATAGRAM_SIZE).
+     */
+    explicit Fragmenter(uint32_t maxDatagramSize) noexcept
+        : m_maxDatagramSize{(maxDatagramSize < 2 * OVERHEAD) ? 2 * OVERHEAD : ((maxDatagramSize > MAX_DATAGRAM_SIZE) ? +MAX_DATAGRAM_SIZE : maxDatagramSize)} {}
+
+    /**
+     * This method sends the given serialized message either as is or as fragments.
+     *
+     * @param sender EnvelopeSender to send with.
+     * @param dataType Message identifier of the serialized message.
+     * @param parts Buffers forming the serialized message.
+     * @param numberOfParts Number of buffers (less than EnvelopeSender::MAX_PARTS).
+     * @param sampleTimeStamp Time point when this sample was captured.
+     * @param senderStamp Sender stamp.
+     * @param pacer Pacer to wait for before every datagram or nullptr.
+     * @param groupSize Number of fragments protected by one parity fragment (at least 2) or 0 for none.
+     * @return Number of datagrams that were sent successfully.
+     */
+    uint32_t send(EnvelopeSender &sender, int32_t dataType, const struct iovec *parts, uint32_t numberOfParts, const cluon::data::TimeStamp &sampleTimeStamp, uint32_t senderStamp, Pacer *pacer = nullptr, uint32_t groupSize = 0) noexcept {
+        uint32_t size{0};
+        for (uint32_t i{0}; i < numberOfParts; i++) {
+            size += static_cast<uint32_t>(parts[i].iov_len);
+        }
+
+        uint32_t datagrams{0};
+        if (size + OVERHEAD <= m_maxDatagramSize) {
+            if (nullptr != pacer) {
+                pacer->pace(size + OVERHEAD);
+            }
+            datagrams += (0 < sender.send(dataType, parts, numberOfParts, sampleTimeStamp, senderStamp).first) ? 1 : 0;
+        }
+        else {
+            const uint32_t FRAGMENT_SIZE{m_maxDatagramSize - OVERHEAD};
+            const uint32_t NUMBER_OF_FRAGMENTS{(size + FRAGMENT_SIZE - 1) / FRAGMENT_SIZE};
+            const uint32_t NUMBER_OF_PARITY_FRAGMENTS{(1 < groupSize) ? (NUMBER_OF_FRAGMENTS + groupSize - 1) / groupSize : 0};
+            if (NUMBER_OF_FRAGMENTS + NUMBER_OF_PARITY_FRAGMENTS <= MAX_NUMBER_OF_FRAGMENTS) {
+                if (0 < NUMBER_OF_PARITY_FRAGMENTS) {
+                    m_parity.resize(std::max<std::size_t>(m_parity.size(), NUMBER_OF_PARITY_FRAGMENTS * FRAGMENT_SIZE));
+                    std::memset(m_parity.data(), 0, NUMBER_OF_PARITY_FRAGMENTS * FRAGMENT_SIZE);
+                }
+
+                uint32_t part{0};
+                uint32_t offsetInPart{0};
+                for (uint32_t i{0}; i < NUMBER_OF_FRAGMENTS; i++) {
+                    const uint32_t OFFSET{i * FRAGMENT_SIZE};
+                    const uint32_t LENGTH{((size - OFFSET) < FRAGMENT_SIZE) ? (size - OFFSET) : FRAGMENT_SIZE};
+
+                    ProtoWriter fields{m_fields, sizeof(m_fields)};
+                    fields.varInt(1, m_frameIdentifier)
+                        .varInt(2, i)
+                        .varInt(3, NUMBER_OF_FRAGMENTS)
+                        .varInt(4, static_cast<uint32_t>(dataType))
+                        .varInt(5, OFFSET)
+                        .varInt(6, size);
+                    if (0 < NUMBER_OF_PARITY_FRAGMENTS) {
+                        fields.varInt(8, NUMBER_OF_PARITY_FRAGMENTS);
+                    }
+                    // The fragment's data follows its header as last field.
+                    fields.bytesHeader(7, LENGTH);
+                    m_parts[0].iov_base = m_fields;
+                    m_parts[0].iov_len = fields.size();
+
+                    // Slice [OFFSET, OFFSET + LENGTH) from the given buffers.
+                    uint32_t numberOfFragmentParts{1};
+                    uint32_t remaining{LENGTH};
+                    while ((0 < remaining) && (part < numberOfParts)) {
+                        const uint32_t AVAILABLE{static_cast<uint32_t>(parts[part].iov_len) - offsetInPart};
+                        const uint32_t TAKE{(remaining < AVAILABLE) ? remaining : AVAILABLE};
+                        m_parts[numberOfFragmentParts].iov_base = static_cast<char*>(parts[part].iov_base) + offsetInPart;
+                        m_parts[numberOfFragmentParts].iov_len = TAKE;
+                        if (0 < NUMBER_OF_PARITY_FRAGMENTS) {
+                            const char *src{static_cast<const char*>(m_parts[numberOfFragmentParts].iov_base)};
+                            char *dst{m_parity.data() + (i % NUMBER_OF_PARITY_FRAGMENTS) * FRAGMENT_SIZE + (LENGTH - remaining)};
+                            for (uint32_t j{0}; j < TAKE; j++) {
+                                dst[j] ^= src[j];
+                            }
+                        }
+                        numberOfFragmentParts++;
+                        remaining -= TAKE;
+                        offsetInPart += TAKE;
+                        if (offsetInPart == parts[part].iov_len) {
+                            part++;
+                            offsetInPart = 0;
+                        }
+                    }
+
+                    if (nullptr != pacer) {
+                        pacer->pace(fields.size() + LENGTH + OVERHEAD);
+                    }
+                    datagrams += (0 < sender.send(opendlv::video::ImageReadingFragment::ID(), m_parts, numberOfFragmentParts, sampleTimeStamp, senderStamp).first) ? 1 : 0;
+                }
+
+                // The parity follows the fragments so that it does not delay them.
+                for (uint32_t i{0}; i < NUMBER_OF_PARITY_FRAGMENTS; i++) {
+                    ProtoWriter fields{m_fields, sizeof(m_fields)};
+                    fields.varInt(1, m_frameIdentifier)
+                        .varInt(2, NUMBER_OF_FRAGMENTS + i)
+                        .varInt(3, NUMBER_OF_FRAGMENTS)
+                        .varInt(4, static_cast<uint32_t>(dataType))
+                        .varInt(5, 0)
+                        .varInt(6, size)
+                        .varInt(8, NUMBER_OF_PARITY_FRAGMENTS)
+                        .bytesHeader(7, FRAGMENT_SIZE);
+                    m_parts[0].iov_base = m_fields;
+                    m_parts[0].iov_len = fields.size();
+                    m_parts[1].iov_base = m_parity.data() + i * FRAGMENT_SIZE;
+                    m_parts[1].iov_len = FRAGMENT_SIZE;
+
+                    if (nullptr != pacer) {
+                        pacer->pace(fields.size() + FRAGMENT_SIZE + OVERHEAD);
+                    }
+                    const uint32_t SENT{(0 < sender.send(opendlv::video::ImageReadingFragment::ID(), m_parts, 2, sampleTimeStamp, senderStamp).first) ? 1u : 0u};
+                    m_parityFragmentsSent += SENT;
+                    datagrams += SENT;
+                }
+                m_fragmentsSent += datagrams;
+            }
+            m_frameIdentifier++;
+        }
+        return datagrams;
+    }
+
+    /**
+     * This method allocates the parity fragments for messages up to the given
+     * size, so that sending them does not allocate.
+     *
+     * @param maxSize Size of the largest serialized message in bytes.
+     * @param groupSize Smallest number of fragments protected by one parity fragment or 0 for none.
+     */
+    void reserve(uint32_t maxSize, uint32_t groupSize) noexcept {
+        const uint32_t FRAGMENT_SIZE{m_maxDatagramSize - OVERHEAD};
+        const uint32_t NUMBER_OF_FRAGMENTS{(maxSize + FRAGMENT_SIZE - 1) / FRAGMENT_SIZE};
+        const uint32_t NUMBER_OF_PARITY_FRAGMENTS{(1 < groupSize) ? (NUMBER_OF_FRAGMENTS + groupSize - 1) / groupSize : 0};
+        m_parity.resize(std::max<std::size_t>(m_parity.size(), NUMBER_OF_PARITY_FRAGMENTS * FRAGMENT_SIZE));
+    }
+
+    /**
+     * @return Number of fragments sent so far.
+     */
+    uint64_t fragmentsSent() const noexcept {
+        return m_fragmentsSent;
+    }
+
+    /**
+     * @return Number of parity fragments sent so far (included in fragmentsSent()).
+     */
+    uint64_t parityFragmentsSent() const noexcept {
+        return m_parityFragmentsSent;
+    }
+
+   private:
+    static constexpr uint32_t MAX_NUMBER_OF_FRAGMENTS{0xFFFF};
+
+    uint32_t m_maxDatagramSize;
+    uint32_t m_frameIdentifier{0};
+    uint64_t m_fragmentsSent{0};
+    uint64_t m_parityFragmentsSent{0};
+
+    char m_fields[64]{};
+    std::vector<char> m_parity{};
+    struct iovec m_parts[EnvelopeSender::MAX_PARTS]{};
+};
+
+/**
+ * This class reassembles messages from opendlv::video::ImageReadingFragment
+ * messages; one message per senderStamp can be in reassembly at a time, and
+ * fragments of an older message are dropped unless their message is so far
+ * behind that the sender must have been restarted. Lost
+ * fragments are restored from the parity fragments sent by a Fragmenter with
+ * forward error correction as soon as all other fragments of their group and
+ * the group's parity were received.
+ *
+ * Example:
+ * @code
+ * Reassembler reassembler;
+ * od4.dataTrigger(opendlv::video::ImageReadingFragment::ID(), [&reassembler](cluon::data::Envelope &&env){
+ *     auto r = reassembler.process(std::move(env));
+ *     if (r.first && (opendlv::proxy::ImageReading::ID() == r.second.dataType())) {
+ *         auto ir = cluon::extractMessage<opendlv::proxy::ImageReading>(std::move(r.second));
+ *     }
+ * });
+ * @endcode
+ */
+class Reassembler {
+   private:
+    Reassembler(const Reassembler &) = delete;
+    Reassembler(Reassembler &&)      = delete;
+    Reassembler &operator=(const Reassembler &) = delete;
+    Reassembler &operator=(Reassembler &&) = delete;
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param maxMessageSize Largest message in bytes to reassemble; larger messages are rejected.
+     */
+    explicit Reassembler(uint32_t maxMessageSize = DEFAULT_MAX_MESSAGE_SIZE) noexcept
+        : m_maxMessageSize{maxMessageSize} {}
+
+    /**
+     * @param envelope Envelope carrying an opendlv::video::ImageReadingFragment.
+     * @return (true, Envelope carrying the original message) when the last missing fragment was received.
+     */
+    std::pair<bool, cluon::data::Envelope> process(cluon::data::Envelope &&envelope) noexcept {
+        std::pair<bool, cluon::data::Envelope> retVal{false, cluon::data::Envelope()};
+        if (opendlv::video::ImageReadingFragment::ID() != envelope.dataType()) {
+            return retVal;
+        }
+        const uint32_t SENDER_STAMP{envelope.senderStamp()};
+        const cluon::data::TimeStamp SENT{envelope.sent()};
+        const cluon::data::TimeStamp RECEIVED{envelope.received()};
+        const cluon::data::TimeStamp SAMPLE_TIME_STAMP{envelope.sampleTimeStamp()};
+        auto fragment = cluon::extractMessage<opendlv::video::ImageReadingFragment>(std::move(envelope));
+        m_fragmentsReceived++;
+
+        // The sizes are checked before anything is allocated for them: all but the last fragment
+        // carry a full fragment of data (as does the parity) and the message has to need all of them.
+        const std::string data{fragment.data()};
+        const uint16_t INDEX{fragment.fragmentIndex()};
+        const uint32_t SIZE{fragment.size()};
+        const uint16_t NUMBER_OF_FRAGMENTS{fragment.numberOfFragments()};
+        const uint16_t NUMBER_OF_PARITY_FRAGMENTS{fragment.numberOfParityFragments()};
+        const uint64_t FRAGMENT_SIZE{data.size()};
+        const bool IS_LAST{INDEX + 1u == NUMBER_OF_FRAGMENTS};
+        const bool IS_VALID{(0 < NUMBER_OF_FRAGMENTS) && (NUMBER_OF_PARITY_FRAGMENTS <= NUMBER_OF_FRAGMENTS) && (SIZE <= m_maxMessageSize)
+                            && (IS_LAST ? (static_cast<uint64_t>(fragment.offset()) + FRAGMENT_SIZE == SIZE)
+                                        : (((NUMBER_OF_FRAGMENTS - 1u) * FRAGMENT_SIZE < SIZE) && (SIZE <= NUMBER_OF_FRAGMENTS * FRAGMENT_SIZE)
+                                           && ((NUMBER_OF_FRAGMENTS <= INDEX) || (fragment.offset() == INDEX * FRAGMENT_SIZE))))};
+        if (!IS_VALID) {
+            m_fragmentsRejected++;
+            return retVal;
+        }
+
+        Message &m = m_messages[SENDER_STAMP];
+        const uint32_t FRAME_IDENTIFIER{fragment.frameIdentifier()};
+        if (m.initialized && (FRAME_IDENTIFIER == m.frameIdentifier)
+            && ((NUMBER_OF_FRAGMENTS != m.numberOfFragments) || (NUMBER_OF_PARITY_FRAGMENTS != m.numberOfParityFragments) || (SIZE != m.data.size()))) {
+            // All fragments of a message have to agree with its first one.
+            m_fragmentsRejected++;
+            return retVal;
+        }
+        if (!m.initialized || (FRAME_IDENTIFIER != m.frameIdentifier)) {
+            if (m.initialized) {
+                const int32_t DELTA{static_cast<int32_t>(FRAME_IDENTIFIER - m.frameIdentifier)};
+                if ((DELTA < 0) && (-MAX_LATE_MESSAGES <= DELTA)) {
+                    // Late fragment from a message that was already given up.
+                    return retVal;
+                }
+                // Messages that were skipped entirely and the unfinished one are lost; a message
+                // far behind the current one means that the sender restarted counting from 0.
+                m_framesLost += ((0 < DELTA) ? static_cast<uint64_t>(DELTA - 1) : 0) + (m.complete ? 0 : 1);
+            }
+            m.initialized = true;
+            m.complete = false;
+            m.frameIdentifier = FRAME_IDENTIFIER;
+            m.numberOfFragments = NUMBER_OF_FRAGMENTS;
+            m.numberOfParityFragments = NUMBER_OF_PARITY_FRAGMENTS;
+            m.fragmentsReceived = 0;
+            m.hasFragment.assign(m.numberOfFragments, false);
+            m.hasParity.assign(m.numberOfParityFragments, false);
+            m.groupFragmentsReceived.assign(m.numberOfParityFragments, 0);
+            m.parity.clear();
+            m.recovered = false;
+            m.data.assign(SIZE, '\0');
+        }
+
+        if (m.complete) {
+            return retVal;
+        }
+        if (INDEX < m.numberOfFragments) {
+            if (m.hasFragment[INDEX] || (fragment.offset() + data.size() > m.data.size())) {
+                return retVal;
+            }
+            m.data.replace(fragment.offset(), data.size(), data);
+            m.hasFragment[INDEX] = true;
+            m.fragmentsReceived++;
+            if (0 < m.numberOfParityFragments) {
+                m.groupFragmentsReceived[INDEX % m.numberOfParityFragments]++;
+                recover(m, INDEX % m.numberOfParityFragments);
+            }
+        }
+        else if (INDEX < m.numberOfFragments + m.numberOfParityFragments) {
+            // Parity fragments carry the size of a full fragment.
+            const uint32_t GROUP{static_cast<uint32_t>(INDEX - m.numberOfFragments)};
+            if (m.hasParity[GROUP] || data.empty() || (!m.parity.empty() && (m.fragmentSize != data.size()))) {
+                return retVal;
+            }
+            if (m.parity.empty()) {
+                m.fragmentSize = static_cast<uint32_t>(data.size());
+                m.parity.assign(m.numberOfParityFragments * m.fragmentSize, '\0');
+            }
+            m.parity.replace(GROUP * m.fragmentSize, data.size(), data);
+            m.hasParity[GROUP] = true;
+            recover(m, GROUP);
+        }
+        else {
+            return retVal;
+        }
+
+        if (m.fragmentsReceived == m.numberOfFragments) {
+            m.complete = true;
+            m_framesReassembled++;
+            m_framesRecovered += (m.recovered ? 1 : 0);
+
+            retVal.first = true;
+            retVal.second.dataType(static_cast<int32_t>(fragment.dataType()))
+                .serializedData(m.data)
+                .sent(SENT)
+                .received(RECEIVED)
+                .sampleTimeStamp(SAMPLE_TIME_STAMP)
+                .senderStamp(SENDER_STAMP);
+        }
+        return retVal;
+    }
+
+    /**
+     * @return Number of fragments received so far.
+     */
+    uint64_t fragmentsReceived() const noexcept {
+        return m_fragmentsReceived;
+    }
+
+    /**
+     * @return Number of fragments rejected so far as inconsistent or too large.
+     */
+    uint64_t fragmentsRejected() const noexcept {
+        return m_fragmentsRejected;
+    }
+
+    /**
+     * @return Number of messages that were completely reassembled.
+     */
+    uint64_t framesReassembled() const noexcept {
+        return m_framesReassembled;
+    }
+
+    /**
+     * @return Number of messages with at least one missing fragment.
+     */
+    uint64_t framesLost() const noexcept {
+        return m_framesLost;
+    }
+
+    /**
+     * @return Number of fragments restored from parity fragments.
+     */
+    uint64_t fragmentsRecovered() const noexcept {
+        return m_fragmentsRecovered;
+    }
+
+    /**
+     * @return Number of reassembled messages that needed at least one restored fragment.
+     */
+    uint64_t framesRecovered() const noexcept {
+        return m_framesRecovered;
+    }
+
+    // Large enough for an uncompressed 4K frame.
+    static constexpr uint32_t DEFAULT_MAX_MESSAGE_SIZE{32 * 1024 * 1024};
+
+   private:
+    // Fragments of messages up to this many messages behind the current one are late; fragments
+    // of older messages start a new reassembly as the sender was restarted.
+    static constexpr int32_t MAX_LATE_MESSAGES{16};
+
+    struct Message {
+        bool initialized{false};
+        bool complete{false};
+        bool recovered{false};
+        uint32_t frameIdentifier{0};
+        uint16_t numberOfFragments{0};
+        uint16_t fragmentsReceived{0};
+        std::vector<bool> hasFragment{};
+        std::string data{};
+
+        // Forward error correction; fragment i belongs to group i % numberOfParityFragments.
+        uint16_t numberOfParityFragments{0};
+        uint32_t fragmentSize{0};
+        std::vector<bool> hasParity{};
+        std::vector<uint16_t> groupFragmentsReceived{};
+        std::string parity{};
+    };
+
+    // Restores the only missing fragment of the given group from its parity.
+    void recover(Message &m, uint32_t group) noexcept {
+        const uint32_t N{m.numberOfParityFragments};
+        const uint32_t MEMBERS{(m.numberOfFragments - group + N - 1) / N};
+        if (!m.hasParity[group] || (m.groupFragmentsReceived[group] + 1u != MEMBERS)) {
+            return;
+        }
+        uint32_t missing{group};
+        while ((missing < m.numberOfFragments) && m.hasFragment[missing]) {
+            missing += N;
+        }
+        const std::size_t OFFSET{static_cast<std::size_t>(missing) * m.fragmentSize};
+        if ((missing >= m.numberOfFragments) || (OFFSET >= m.data.size())) {
+            return;
+        }
+        const std::size_t LENGTH{std::min<std::size_t>(m.fragmentSize, m.data.size() - OFFSET)};
+        char *dst{&m.data[OFFSET]};
+        std::memcpy(dst, &m.parity[group * m.fragmentSize], LENGTH);
+        for (uint32_t i{group}; i < m.numberOfFragments; i += N) {
+            const std::size_t OTHER{static_cast<std::size_t>(i) * m.fragmentSize};
+            if ((i != missing) && (OTHER < m.data.size())) {
+                const char *src{&m.data[OTHER]};
+                const std::size_t OTHER_LENGTH{std::min(LENGTH, m.data.size() - OTHER)};
+                for (std::size_t j{0}; j < OTHER_LENGTH; j++) {
+                    dst[j] ^= src[j];
+                }
+            }
+        }
+        m.hasFragment[missing] = true;
+        m.fragmentsReceived++;
+        m.groupFragmentsReceived[group]++;
+        m.recovered = true;
+        m_fragmentsRecovered++;
+    }
+
+    uint32_t m_maxMessageSize;
+    std::map<uint32_t, Message> m_messages{};
+    uint64_t m_fragmentsReceived{0};
+    uint64_t m_fragmentsRejected{0};
+    uint64_t m_framesReassembled{0};
+    uint64_t m_framesLost{0};
+    uint64_t m_fragmentsRecovered{0};
+    uint64_t m_framesRecovered{0};
+};
+
+#endif
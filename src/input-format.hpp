@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INPUT_FORMAT_HPP
+#define INPUT_FORMAT_HPP
+
+#include <vpx/vpx_image.h>
+#include <libyuv.h>
+
+#include <cstdint>
+#include <string>
+
+/**
+ * This class describes the layout of a frame in a shared memory area and
+ * converts it into I420 with libyuv's SIMD routines. Rows can be longer
+ * than the visible width (stride) and planes can have more rows than the
+ * visible height (plane height); chroma planes of planar formats follow
+ * the luma plane with half (I420) or full (NV12) stride.
+ *
+ * Supported formats with their byte order in memory:
+ * - i420: Y plane, U plane, V plane
+ * - nv12: Y plane, interleaved U and V plane
+ * - yuyv: Y0 U Y1 V
+ * - uyvy: U Y0 V Y1
+ * - rgb24: R G B
+ * - bgr24: B G R
+ * - rgba: R G B A
+ * - bgra: B G R A
+ */
+class InputFormat {
+   private:
+    InputFormat(const InputFormat &) = delete;
+    InputFormat(InputFormat &&)      = delete;
+    InputFormat &operator=(const InputFormat &) = delete;
+    InputFormat &operator=(InputFormat &&) = delete;
+
+   public:
+    enum Format { UNKNOWN, I420, NV12, YUYV, UYVY, RGB24, BGR24, RGBA, BGRA };
+
+    /**
+     * Constructor.
+     *
+     * @param name Name of the format as listed above.
+     * @param width Width of the frame.
+     * @param height Height of the frame.
+     * @param stride Bytes per row of the first plane or 0 for tightly packed rows.
+     * @param planeHeight Rows per plane or 0 for the height of the frame.
+     */
+    InputFormat(const std::string &name, uint32_t width, uint32_t height, uint32_t stride, uint32_t planeHeight) noexcept
+        : m_format{toFormat(name)}
+        , m_width{width}
+        , m_height{height}
+        , m_stride{(0 < stride) ? stride : width * bytesPerPixel(m_format)}
+        , m_planeHeight{(0 < planeHeight) ? planeHeight : height} {}
+
+    /**
+     * @return true if the format is known and the layout holds the frame.
+     */
+    bool valid() const noexcept {
+        return (UNKNOWN != m_format) && (m_width * bytesPerPixel(m_format) <= m_stride) && (m_height <= m_planeHeight);
+    }
+
+    /**
+     * @return Format of the frame.
+     */
+    Format format() const noexcept {
+        return m_format;
+    }
+
+    /**
+     * @return Number of bytes needed to hold a frame.
+     */
+    uint32_t size() const noexcept {
+        const uint32_t PLANE{m_stride * m_planeHeight};
+        if (I420 == m_format) {
+            return PLANE + 2 * ((m_stride + 1) / 2) * ((m_planeHeight + 1) / 2);
+        }
+        if (NV12 == m_format) {
+            return PLANE + m_stride * ((m_planeHeight + 1) / 2);
+        }
+        return PLANE;
+    }
+
+    /**
+     * This method tells whether the frame can be handed to libvpx without
+     * conversion, which is the case for I420 and, from libvpx 1.8.1 on,
+     * for NV12.
+     *
+     * @return true if wrap() is supported.
+     */
+    bool wrappable() const noexcept {
+#if VPX_IMAGE_ABI_VERSION >= 5
+        return (I420 == m_format) || (NV12 == m_format);
+#else
+        return (I420 == m_format);
+#endif
+    }
+
+    /**
+     * This method points the given image to a frame without copying it.
+     *
+     * @param src Pointer to the frame.
+     * @param img Image to wrap the frame in.
+     * @return true if the frame could be wrapped.
+     */
+    bool wrap(const char *src, vpx_image_t *img) const noexcept {
+        uint8_t *y{reinterpret_cast<uint8_t*>(const_cast<char*>(src))};
+        uint8_t *uv{y + m_stride * m_planeHeight};
+        if (I420 == m_format) {
+            if (!vpx_img_wrap(img, VPX_IMG_FMT_I420, m_width, m_height, 1, y)) {
+                return false;
+            }
+            img->planes[VPX_PLANE_U] = uv;
+            img->planes[VPX_PLANE_V] = uv + ((m_stride + 1) / 2) * ((m_planeHeight + 1) / 2);
+            img->stride[VPX_PLANE_U] = static_cast<int>((m_stride + 1) / 2);
+            img->stride[VPX_PLANE_V] = static_cast<int>((m_stride + 1) / 2);
+        }
+#if VPX_IMAGE_ABI_VERSION >= 5
+        else if (NV12 == m_format) {
+            if (!vpx_img_wrap(img, VPX_IMG_FMT_NV12, m_width, m_height, 1, y)) {
+                return false;
+            }
+            img->planes[VPX_PLANE_U] = uv;
+            img->planes[VPX_PLANE_V] = uv + 1;
+            img->stride[VPX_PLANE_U] = static_cast<int>(m_stride);
+            img->stride[VPX_PLANE_V] = static_cast<int>(m_stride);
+        }
+#endif
+        else {
+            return false;
+        }
+        img->planes[VPX_PLANE_Y] = y;
+        img->stride[VPX_PLANE_Y] = static_cast<int>(m_stride);
+        return true;
+    }
+
+    /**
+     * This method converts a region of a frame into an I420 image.
+     *
+     * @param src Pointer to the frame.
+     * @param x Left column of the region; must be even.
+     * @param y Top row of the region; must be even.
+     * @param dst I420 image to convert into; its dimensions define the size of the region.
+     */
+    void convert(const char *src, uint32_t x, uint32_t y, vpx_image_t *dst) const noexcept {
+        const uint8_t *first{reinterpret_cast<const uint8_t*>(src) + y * m_stride + x * bytesPerPixel(m_format)};
+        const uint8_t *uv{reinterpret_cast<const uint8_t*>(src) + m_stride * m_planeHeight};
+        const uint32_t UV_STRIDE{(I420 == m_format) ? (m_stride + 1) / 2 : m_stride};
+        const uint8_t *u{uv + (y / 2) * UV_STRIDE + ((I420 == m_format) ? x / 2 : x)};
+        const uint8_t *v{uv + UV_STRIDE * ((m_planeHeight + 1) / 2) + (y / 2) * UV_STRIDE + x / 2};
+        const int32_t S{static_cast<int32_t>(m_stride)};
+        const int32_t W{static_cast<int32_t>(dst->d_w)};
+        const int32_t H{static_cast<int32_t>(dst->d_h)};
+        uint8_t *dstY{dst->planes[VPX_PLANE_Y]};
+        uint8_t *dstU{dst->planes[VPX_PLANE_U]};
+        uint8_t *dstV{dst->planes[VPX_PLANE_V]};
+        const int32_t DST_Y{dst->stride[VPX_PLANE_Y]};
+        const int32_t DST_U{dst->stride[VPX_PLANE_U]};
+        const int32_t DST_V{dst->stride[VPX_PLANE_V]};
+        switch (m_format) {
+            case I420:
+                libyuv::I420Copy(first, S, u, (S + 1) / 2, v, (S + 1) / 2, dstY, DST_Y, dstU, DST_U, dstV, DST_V, W, H);
+                break;
+            case NV12:
+                libyuv::NV12ToI420(first, S, u, S, dstY, DST_Y, dstU, DST_U, dstV, DST_V, W, H);
+                break;
+            case YUYV:
+                libyuv::YUY2ToI420(first, S, dstY, DST_Y, dstU, DST_U, dstV, DST_V, W, H);
+                break;
+            case UYVY:
+                libyuv::UYVYToI420(first, S, dstY, DST_Y, dstU, DST_U, dstV, DST_V, W, H);
+                break;
+            // libyuv names packed RGB formats after their order in a little-endian word.
+            case RGB24:
+                libyuv::RAWToI420(first, S, dstY, DST_Y, dstU, DST_U, dstV, DST_V, W, H);
+                break;
+            case BGR24:
+                libyuv::RGB24ToI420(first, S, dstY, DST_Y, dstU, DST_U, dstV, DST_V, W, H);
+                break;
+            case RGBA:
+                libyuv::ABGRToI420(first, S, dstY, DST_Y, dstU, DST_U, dstV, DST_V, W, H);
+                break;
+            case BGRA:
+                libyuv::ARGBToI420(first, S, dstY, DST_Y, dstU, DST_U, dstV, DST_V, W, H);
+                break;
+            case UNKNOWN:
+                break;
+        }
+    }
+
+    /**
+     * This method hashes every eighth row of the first plane with libyuv's
+     * vectorized djb2, which is enough to tell whether a frame changed.
+     *
+     * @param src Pointer to the frame.
+     * @return Hash of the sampled rows.
+     */
+    uint32_t hash(const char *src) const noexcept {
+        const uint32_t ROW_STEP{8};
+        const uint64_t ROW_SIZE{static_cast<uint64_t>(m_width) * bytesPerPixel(m_format)};
+        uint32_t retVal{5381};
+        for (uint32_t row{0}; row < m_height; row += ROW_STEP) {
+            retVal = libyuv::HashDjb2(reinterpret_cast<const uint8_t*>(src) + row * m_stride, ROW_SIZE, retVal);
+        }
+        return retVal;
+    }
+
+   private:
+    static Format toFormat(const std::string &name) noexcept {
+        return ("i420" == name) ? I420 :
+               ("nv12" == name) ? NV12 :
+               ("yuyv" == name) ? YUYV :
+               ("uyvy" == name) ? UYVY :
+               ("rgb24" == name) ? RGB24 :
+               ("bgr24" == name) ? BGR24 :
+               ("rgba" == name) ? RGBA :
+               ("bgra" == name) ? BGRA : UNKNOWN;
+    }
+
+    // Bytes per pixel in the first plane.
+    static uint32_t bytesPerPixel(Format format) noexcept {
+        return ((YUYV == format) || (UYVY == format)) ? 2 :
+               ((RGB24 == format) || (BGR24 == format)) ? 3 :
+               ((RGBA == format) || (BGRA == format)) ? 4 : 1;
+    }
+
+   private:
+    const Format m_format;
+    const uint32_t m_width;
+    const uint32_t m_height;
+    const uint32_t m_stride;
+    const uint32_t m_planeHeight;
+};
+
+#endif
@@ -0,0 +1,459 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LAYER_ENCODER_HPP
+#define LAYER_ENCODER_HPP
+
+#include "cluon-complete.hpp"
+#include "opendlv-video-message-set.hpp"
+#include "calibrator.hpp"
+#include "encoded-frame.hpp"
+#include "frame-pool.hpp"
+#include "layer.hpp"
+#include "vpx-encoder.hpp"
+
+#include <vpx/vpx_encoder.h>
+#include <vpx/vp8cx.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+/**
+ * This class configures the libvpx encoders of the layers from the settings
+ * given on the command line, applies EncoderControl messages to them, and
+ * encodes their frames. It keeps no state of its own besides the settings,
+ * so that the workers of the threaded pipeline share one instance while
+ * every layer is only encoded by one thread at a time.
+ */
+class LayerEncoder {
+   private:
+    LayerEncoder(const LayerEncoder &) = delete;
+    LayerEncoder(LayerEncoder &&)      = delete;
+    LayerEncoder &operator=(const LayerEncoder &) = delete;
+    LayerEncoder &operator=(LayerEncoder &&) = delete;
+
+   public:
+    static constexpr uint32_t TEMPORAL_LAYERS_MAX{3};
+
+    /**
+     * Settings of all layers as given on the command line; see the usage of the microservice.
+     */
+    struct Settings {
+        uint32_t bitrateMin{50000};  // Range of the bitrates of EncoderControls.
+        uint32_t bitrateMax{5000000};
+        uint32_t threadsPerLayer{1};
+        uint32_t profile{0};
+        uint32_t lagInFrames{0};
+        uint32_t dropFrame{0};
+        uint32_t resizeAllowed{0};
+        uint32_t resizeUp{0};
+        uint32_t resizeDown{0};
+        uint32_t endUsage{0};  // 0 = CBR, otherwise VBR.
+        uint32_t minQuantizer{4};
+        uint32_t undershootPct{0};
+        uint32_t overshootPct{0};
+        uint32_t bufferSize{6000};
+        uint32_t bufferInitSize{4000};
+        uint32_t bufferOptimalSize{5000};
+        uint32_t kfMode{0};  // 1 = no periodic keyframes from libvpx.
+        uint32_t kfMinDist{0};
+        uint32_t kfMaxDist{99999};
+        bool intraRefresh{false};
+        std::vector<uint32_t> svcBitrates{};  // Shares of the spatial layers; empty for 1:2(:4).
+        uint32_t gop{10};
+        uint32_t cpuUsed{5};
+        uint32_t calibrate{0};  // Frames per candidate; 0 = no calibration.
+        int32_t tileColumns{-1};
+        int32_t rowMt{-1};
+        uint32_t frameParallel{0};
+        bool staticCheap{false};           // Encode unchanged frames at the fastest speed instead of skipping them.
+        int64_t staticHeartbeat{1000000};  // Microseconds between unchanged frames that are encoded anyway.
+        bool verbose{false};
+    };
+
+    /**
+     * Constructor.
+     *
+     * @param settings Settings of all layers.
+     * @param delegate Called from the encoding thread with the EncoderStatus acknowledging an EncoderControl and the senderStamp of its layer.
+     */
+    LayerEncoder(const Settings &settings, std::function<void(opendlv::video::EncoderStatus &, uint32_t)> delegate) noexcept
+        : m_settings{settings}
+        , m_delegate{std::move(delegate)} {}
+
+    /**
+     * This method sets the target bitrate in the given configuration. With spatial
+     * layers, every layer gets twice the bitrate of the layer below or the share
+     * given by --svc-bitrates. Within a spatial layer, the temporal layers get a
+     * cumulative share of 60% and 100% or 40%, 60%, and 100%.
+     *
+     * @param bitrate Bitrate of all spatial layers in bits per second.
+     * @param spatialLayers Number of spatial layers.
+     * @param temporalLayers Number of temporal layers.
+     * @param parameters Configuration to set the bitrate in.
+     */
+    void setBitrate(uint32_t bitrate, uint32_t spatialLayers, uint32_t temporalLayers, vpx_codec_enc_cfg_t &parameters) const noexcept {
+        const std::vector<uint32_t> &svcBitrates{m_settings.svcBitrates};
+        parameters.rc_target_bitrate = bitrate/1000;
+        if ((1 < spatialLayers) || (1 < temporalLayers)) {
+            const uint32_t TEMPORAL_SHARE[TEMPORAL_LAYERS_MAX][TEMPORAL_LAYERS_MAX]{{100, 0, 0}, {60, 100, 0}, {40, 60, 100}};
+            uint64_t parts{0};
+            for (uint32_t i{0}; i < spatialLayers; i++) {
+                parts += (svcBitrates.empty() || (1 == spatialLayers)) ? (1u << i) : svcBitrates[i];
+            }
+            parameters.rc_target_bitrate = 0;
+            for (uint32_t i{0}; i < spatialLayers; i++) {
+                const uint64_t WEIGHT{(svcBitrates.empty() || (1 == spatialLayers)) ? (1u << i) : svcBitrates[i]};
+                const uint32_t B{static_cast<uint32_t>(bitrate * WEIGHT / parts / 1000)};
+                parameters.ss_target_bitrate[i] = B;
+                for (uint32_t j{0}; j < temporalLayers; j++) {
+                    parameters.layer_target_bitrate[i * temporalLayers + j] = B * TEMPORAL_SHARE[temporalLayers - 1][j] / 100;
+                }
+                parameters.rc_target_bitrate += B;
+            }
+            for (uint32_t j{0}; j < temporalLayers; j++) {
+                parameters.ts_target_bitrate[j] = parameters.rc_target_bitrate * TEMPORAL_SHARE[temporalLayers - 1][j] / 100;
+            }
+        }
+    }
+
+    /**
+     * This method fills the encoder configuration for the given layer.
+     *
+     * @param encoderAlgorithm VP8 or VP9 encoder interface.
+     * @param layer Layer to configure the encoder for.
+     * @param parameters Configuration to fill.
+     * @return Result of vpx_codec_enc_config_default.
+     */
+    vpx_codec_err_t configure(vpx_codec_iface_t *encoderAlgorithm, const Layer &layer, vpx_codec_enc_cfg_t &parameters) const noexcept {
+        memset(&parameters, 0, sizeof(parameters));
+        vpx_codec_err_t result = vpx_codec_enc_config_default(encoderAlgorithm, &parameters, 0);
+        if (result) {
+            return result;
+        }
+
+        parameters.g_w = layer.width;
+        parameters.g_h = layer.height;
+        // Time stamps and durations in microseconds as derived from the sample time stamps.
+        parameters.g_timebase.num = 1;
+        parameters.g_timebase.den = 1000000;
+
+        // Parameters according to https://www.webmproject.org/docs/encoder-parameters/
+        parameters.g_threads = m_settings.threadsPerLayer;
+        parameters.rc_max_quantizer = (layer.vp8 ? 56 : 52);
+
+        if (m_settings.endUsage == 0) {
+          parameters.rc_end_usage = VPX_CBR;
+        } else {
+          parameters.rc_end_usage = VPX_VBR;
+        }
+
+        parameters.g_profile = m_settings.profile;
+        // A value > 0 allows the encoder to consume more frames before emitting compressed frames.
+        parameters.g_lag_in_frames = m_settings.lagInFrames;
+
+        parameters.rc_dropframe_thresh = m_settings.dropFrame;
+        if (m_settings.resizeAllowed == 0) {
+            parameters.rc_resize_allowed = false;
+        } else {
+            parameters.rc_resize_allowed = true;
+        }
+        parameters.rc_resize_up_thresh = m_settings.resizeUp;
+        parameters.rc_resize_down_thresh = m_settings.resizeDown;
+        // Testing every q below rc_max_quantizer.
+        parameters.rc_min_quantizer = m_settings.minQuantizer;
+        parameters.rc_undershoot_pct = m_settings.undershootPct;
+        parameters.rc_overshoot_pct = m_settings.overshootPct;
+
+        parameters.rc_buf_sz = m_settings.bufferSize;
+        parameters.rc_buf_initial_sz = m_settings.bufferInitSize;
+        parameters.rc_buf_optimal_sz = m_settings.bufferOptimalSize;
+
+        if (m_settings.kfMode == 1) {
+          parameters.kf_mode = vpx_kf_mode::VPX_KF_DISABLED;
+        } else {
+          parameters.kf_mode = vpx_kf_mode::VPX_KF_AUTO;
+        }
+
+        // kf_min_dist has two modes, either 0 or == to kf_max_dist
+        if (m_settings.kfMinDist == 0) {
+            parameters.kf_min_dist = m_settings.kfMinDist;
+        } else {
+            parameters.kf_min_dist = m_settings.kfMaxDist;
+        }
+        parameters.kf_max_dist = m_settings.kfMaxDist;
+
+        if (m_settings.intraRefresh) {
+            // Keyframes only at start and on demand; VP8 enables its cyclic background
+            // refresh in error resilient mode while VP9 uses AQ mode 3 (see open()).
+            parameters.kf_mode = vpx_kf_mode::VPX_KF_DISABLED;
+            if (layer.vp8) {
+                parameters.g_error_resilient = VPX_ERROR_RESILIENT_DEFAULT;
+            }
+        }
+
+        if ((1 < layer.spatialLayers) || (1 < layer.temporalLayers)) {
+            VpxEncoder::configureTemporalLayers(layer.temporalLayers, parameters);
+            parameters.ss_number_layers = layer.spatialLayers;
+        }
+        setBitrate(layer.bitrate, layer.spatialLayers, layer.temporalLayers, parameters);
+        return result;
+    }
+
+    /**
+     * This method initializes the encoder of the given layer and sets its controls.
+     *
+     * @param layer Layer to initialize the encoder for.
+     * @return true if the encoder could be initialized.
+     */
+    bool open(Layer &layer) const noexcept {
+        vpx_codec_iface_t *encoderAlgorithm{(layer.vp8 ? &vpx_codec_vp8_cx_algo : &vpx_codec_vp9_cx_algo)};
+        struct vpx_codec_enc_cfg parameters;
+        vpx_codec_err_t result = configure(encoderAlgorithm, layer, parameters);
+        if (result) {
+            std::cerr << "[opendlv-video-vpx-encoder]: Failed to get default configuration: " << vpx_codec_err_to_string(result) << std::endl;
+            return false;
+        }
+        result = layer.encoder.init(encoderAlgorithm, parameters);
+        if (result) {
+            std::cerr << "[opendlv-video-vpx-encoder]: Failed to initialize encoder: " << vpx_codec_err_to_string(result) << std::endl;
+            return false;
+        }
+        else {
+            std::clog << "[opendlv-video-vpx-encoder]: Using " << vpx_codec_iface_name(encoderAlgorithm) << " for " << layer.width << "x" << layer.height << " at " << layer.bitrate << " bps (senderStamp " << layer.senderStamp << ")" << std::endl;
+        }
+        if (0 < m_settings.calibrate) {
+            // Candidates for real-time encoding from the fastest to the slowest.
+            const std::vector<int32_t> CANDIDATES_VP8{16, 12, 10, 8, 6, 4};
+            const std::vector<int32_t> CANDIDATES_VP9{9, 8, 7, 6, 5};
+            layer.calibrator.reset(new Calibrator{(layer.vp8 ? CANDIDATES_VP8 : CANDIDATES_VP9), m_settings.calibrate, layer.clock.interval()});
+            layer.cpuUsed = layer.calibrator->candidate();
+        }
+        else {
+            layer.cpuUsed = static_cast<int32_t>(m_settings.cpuUsed);
+        }
+        vpx_codec_control(layer.encoder.codec(), VP8E_SET_CPUUSED, layer.cpuUsed);
+        layer.gop = m_settings.gop;
+        if (m_settings.intraRefresh) {
+            // Limit the size of the remaining keyframes to a multiple of the average frame.
+            const uint32_t MAX_INTRA_BITRATE_PCT{300};
+            vpx_codec_control(layer.encoder.codec(), VP8E_SET_MAX_INTRA_BITRATE_PCT, MAX_INTRA_BITRATE_PCT);
+            if (!layer.vp8) {
+                const uint32_t AQ_MODE_CYCLIC_REFRESH{3};
+                vpx_codec_control(layer.encoder.codec(), VP9E_SET_AQ_MODE, AQ_MODE_CYCLIC_REFRESH);
+            }
+        }
+        const uint32_t THREADS_PER_LAYER{m_settings.threadsPerLayer};
+        if (!layer.vp8) {
+            // Without tiles and row based multithreading, VP9 hardly uses more than one core.
+            const uint32_t LOG2_TILE_COLUMNS{(0 <= m_settings.tileColumns) ? static_cast<uint32_t>(m_settings.tileColumns) : VpxEncoder::tileColumns(layer.width, THREADS_PER_LAYER)};
+            const uint32_t USE_ROW_MT{(0 <= m_settings.rowMt) ? static_cast<uint32_t>(m_settings.rowMt) : ((1 < THREADS_PER_LAYER) ? 1u : 0u)};
+            vpx_codec_control(layer.encoder.codec(), VP9E_SET_TILE_COLUMNS, static_cast<int>(LOG2_TILE_COLUMNS));
+            vpx_codec_control(layer.encoder.codec(), VP9E_SET_ROW_MT, USE_ROW_MT);
+            vpx_codec_control(layer.encoder.codec(), VP9E_SET_FRAME_PARALLEL_DECODING, m_settings.frameParallel);
+            std::clog << "[opendlv-video-vpx-encoder]: Using " << THREADS_PER_LAYER << " thread(s), " << (1u << LOG2_TILE_COLUMNS) << " tile column(s), row-mt = " << USE_ROW_MT << ", frame-parallel = " << m_settings.frameParallel << std::endl;
+        }
+        else {
+            std::clog << "[opendlv-video-vpx-encoder]: Using " << THREADS_PER_LAYER << " thread(s)" << std::endl;
+        }
+        if (!layer.vp8 && ((1 < layer.spatialLayers) || (1 < layer.temporalLayers))) {
+            vpx_svc_extra_cfg_t svcParameters;
+            memset(&svcParameters, 0, sizeof(svcParameters));
+            for (uint32_t i{0}; i < layer.spatialLayers; i++) {
+                svcParameters.scaling_factor_num[i] = 1;
+                svcParameters.scaling_factor_den[i] = 1 << (layer.spatialLayers - 1 - i);
+                svcParameters.max_quantizers[i] = static_cast<int>(parameters.rc_max_quantizer);
+                svcParameters.min_quantizers[i] = static_cast<int>(parameters.rc_min_quantizer);
+            }
+            vpx_codec_control(layer.encoder.codec(), VP9E_SET_SVC, 1);
+            vpx_codec_control(layer.encoder.codec(), VP9E_SET_SVC_PARAMETERS, &svcParameters);
+        }
+        if ((1 < layer.spatialLayers) || (1 < layer.temporalLayers)) {
+            std::clog << "[opendlv-video-vpx-encoder]: Encoding " << layer.spatialLayers << " spatial layer(s) down to " << layer.spatialWidth(0) << "x" << layer.spatialHeight(0) << " and " << layer.temporalLayers << " temporal layer(s)" << std::endl;
+        }
+        return true;
+    }
+
+    /**
+     * This method applies an EncoderControl to the given layer and acknowledges it
+     * with an EncoderStatus. All fields are checked first, and the control takes
+     * effect as a whole or not at all.
+     *
+     * @param layer Layer to apply the control to.
+     * @param c Control to apply.
+     * @param flags Flags of the next frame, which gets VPX_EFLAG_FORCE_KF if requested.
+     */
+    void control(Layer &layer, const opendlv::video::EncoderControl &c, int &flags) const noexcept {
+        const vpx_codec_enc_cfg_t PREVIOUS{layer.encoder.parameters()};
+        vpx_codec_enc_cfg_t parameters{PREVIOUS};
+        const uint32_t BITRATE_OF_LAYER{(0 < c.bitrate()) ? std::min(std::max(c.bitrate(), m_settings.bitrateMin), m_settings.bitrateMax) : layer.bitrate};
+        setBitrate(BITRATE_OF_LAYER, layer.spatialLayers, layer.temporalLayers, parameters);
+        // Fields keeping their default value (-1) are left unchanged.
+        const int32_t MIN_QUANTIZER{(-1 == c.minQuantizer()) ? static_cast<int32_t>(PREVIOUS.rc_min_quantizer) : c.minQuantizer()};
+        const int32_t MAX_QUANTIZER{(-1 == c.maxQuantizer()) ? static_cast<int32_t>(PREVIOUS.rc_max_quantizer) : c.maxQuantizer()};
+        const int32_t MAX_CPU_USED{layer.vp8 ? 16 : 9};
+        const bool CPU_USED{-1 != c.cpuUsed()};
+        const bool VALID{(0 <= MIN_QUANTIZER) && (MIN_QUANTIZER <= MAX_QUANTIZER) && (MAX_QUANTIZER <= 63) && (-1 <= c.gop())
+                         && (!CPU_USED || ((-MAX_CPU_USED <= c.cpuUsed()) && (c.cpuUsed() <= MAX_CPU_USED)))};
+        parameters.rc_min_quantizer = static_cast<uint32_t>(std::max(MIN_QUANTIZER, 0));
+        parameters.rc_max_quantizer = static_cast<uint32_t>(std::max(MAX_QUANTIZER, 0));
+
+        vpx_codec_err_t result{VALID ? VPX_CODEC_OK : VPX_CODEC_INVALID_PARAM};
+        if (!VALID) {
+            std::cerr << "[opendlv-video-vpx-encoder]: Rejected control " << c.requestIdentifier() << " to senderStamp " << layer.senderStamp << ": expected 0 <= min-q <= max-q <= 63, gop >= 0, and " << -MAX_CPU_USED << " <= cpu-used <= " << MAX_CPU_USED << "." << std::endl;
+        }
+        if ((VPX_CODEC_OK == result) && CPU_USED && (c.cpuUsed() != layer.cpuUsed)) {
+            result = vpx_codec_control(layer.encoder.codec(), VP8E_SET_CPUUSED, c.cpuUsed());
+            if (VPX_CODEC_OK != result) {
+                std::cerr << "[opendlv-video-vpx-encoder]: Failed to set cpu-used: " << vpx_codec_err_to_string(result) << std::endl;
+            }
+        }
+        if ( (VPX_CODEC_OK == result)
+             && ((BITRATE_OF_LAYER != layer.bitrate) || (parameters.rc_min_quantizer != PREVIOUS.rc_min_quantizer) || (parameters.rc_max_quantizer != PREVIOUS.rc_max_quantizer)) ) {
+            result = layer.encoder.reconfigure(parameters);
+            if (VPX_CODEC_OK != result) {
+                std::cerr << "[opendlv-video-vpx-encoder]: Failed to reconfigure encoder: " << vpx_codec_err_to_string(result) << std::endl;
+                // Nothing of a rejected control stays in effect.
+                if (CPU_USED && (c.cpuUsed() != layer.cpuUsed)) {
+                    vpx_codec_control(layer.encoder.codec(), VP8E_SET_CPUUSED, layer.cpuUsed);
+                }
+            }
+        }
+
+        if (VPX_CODEC_OK == result) {
+            layer.bitrate = BITRATE_OF_LAYER;
+            // A GOP of 0 disables periodic keyframes.
+            if (0 <= c.gop()) {
+                layer.gop = static_cast<uint32_t>(c.gop());
+            }
+            if (CPU_USED) {
+                // An explicit setting ends a running calibration.
+                layer.calibrator.reset();
+                layer.cpuUsed = c.cpuUsed();
+            }
+            if (c.forceKeyFrame()) {
+                flags |= VPX_EFLAG_FORCE_KF;
+            }
+        }
+
+        // The status reports the settings in effect afterwards.
+        opendlv::video::EncoderStatus status;
+        status.requestIdentifier(c.requestIdentifier())
+              .accepted(VPX_CODEC_OK == result)
+              .bitrate(layer.bitrate)
+              .minQuantizer(static_cast<int32_t>(layer.encoder.parameters().rc_min_quantizer))
+              .maxQuantizer(static_cast<int32_t>(layer.encoder.parameters().rc_max_quantizer))
+              .gop(layer.gop)
+              .cpuUsed(layer.cpuUsed);
+        if (m_delegate) {
+            m_delegate(status, layer.senderStamp);
+        }
+
+        if (m_settings.verbose) {
+            std::clog << "[opendlv-video-vpx-encoder]: " << (status.accepted() ? "Applied" : "Rejected") << " control " << c.requestIdentifier() << " to senderStamp " << layer.senderStamp << "; now bitrate = " << status.bitrate() << ", min-q = " << status.minQuantizer() << ", max-q = " << status.maxQuantizer() << ", gop = " << status.gop() << ", cpu-used = " << status.cpuUsed() << ((status.accepted() && c.forceKeyFrame()) ? ", keyframe" : "") << std::endl;
+        }
+    }
+
+    /**
+     * This method encodes the given frame for the given layer after applying its
+     * pending controls, downscaling the frame first if needed.
+     *
+     * @param layer Layer to encode the frame for.
+     * @param frame Frame of the layer's source.
+     * @param sampleTimeStamp Capture time of the frame.
+     * @param unchanged True if the frame hardly differs from the previous one.
+     * @param out Encoded frame.
+     * @param copy Unless set, out.payload points to the encoder's output buffer for single packet frames.
+     * @return true if a VP8 or VP9 frame was stored in out.
+     */
+    bool encode(Layer &layer, vpx_image_t *frame, const cluon::data::TimeStamp &sampleTimeStamp, bool unchanged, EncodedFrame &out, bool copy) const noexcept {
+        // The GOP counts from the last keyframe, which might have been requested; a GOP
+        // of 0 disables periodic keyframes.
+        int flags{ ((0 == layer.frameCounter) || ((0 < layer.gop) && (layer.gop <= layer.framesSinceKeyFrame))) ? VPX_EFLAG_FORCE_KF : 0 };
+        opendlv::video::EncoderControl c;
+        while (layer.controls.pop(c)) {
+            control(layer, c, flags);
+        }
+        if (layer.keyFrameRequested.exchange(false)) {
+            flags |= VPX_EFLAG_FORCE_KF;
+        }
+        const int64_t PTS{layer.clock.update(sampleTimeStamp)};
+
+        // Unchanged frames are skipped until the heartbeat is due or encoded at the fastest
+        // speed; keyframes are always encoded.
+        const bool CHEAP{unchanged && (0 == (flags & VPX_EFLAG_FORCE_KF))};
+        if (CHEAP && !m_settings.staticCheap && (PTS - layer.lastEncodedPts < m_settings.staticHeartbeat)) {
+            layer.unchangedFramesSkipped++;
+            out.size = 0;
+            return false;
+        }
+        if (CHEAP && m_settings.staticCheap) {
+            vpx_codec_control(layer.encoder.codec(), VP8E_SET_CPUUSED, (layer.vp8 ? 16 : 9));
+        }
+
+        // Layers are scaled with the filter chosen for their source.
+        if (layer.scaledFrame.valid()) {
+            FramePool::scaleI420(frame, layer.scaledFrame.frame(0), layer.filter);
+            frame = layer.scaledFrame.frame(0);
+        }
+        vpx_codec_err_t result = layer.encoder.encode(frame, PTS, static_cast<unsigned long>(layer.clock.interval()), flags, out, copy);
+        out.bitrate = layer.bitrate;
+        out.frameInterval = layer.clock.interval();
+        if (result) {
+            std::cerr << "[opendlv-video-vpx-encoder]: Failed to encode frame: " << vpx_codec_err_to_string(result) << std::endl;
+        }
+        if (0 < out.size) {
+            layer.frameCounter++;
+            layer.framesSinceKeyFrame = (out.keyFrame ? 1 : layer.framesSinceKeyFrame + 1);
+            layer.lastEncodedPts = PTS;
+            layer.unchangedFramesEncoded += (unchanged ? 1 : 0);
+        }
+        if (CHEAP && m_settings.staticCheap) {
+            vpx_codec_control(layer.encoder.codec(), VP8E_SET_CPUUSED, layer.cpuUsed);
+            return (0 < out.size);
+        }
+
+        if (layer.calibrator && layer.calibrator->calibrating()) {
+            Calibrator &calibrator{*layer.calibrator};
+            calibrator.budget(layer.clock.interval());
+            if (calibrator.update(out.encodingDuration)) {
+                layer.cpuUsed = calibrator.candidate();
+                vpx_codec_control(layer.encoder.codec(), VP8E_SET_CPUUSED, layer.cpuUsed);
+            }
+            if (!calibrator.calibrating()) {
+                std::stringstream measured;
+                for (uint32_t i{0}; (i < calibrator.size()) && (0 < calibrator.percentile(i)); i++) {
+                    measured << (0 < i ? ", " : "") << calibrator.candidate(i) << ": " << calibrator.percentile(i);
+                }
+                std::clog << "[opendlv-video-vpx-encoder]: Calibrated " << layer.width << "x" << layer.height << " to cpu-used = " << calibrator.candidate() << " with p99 = " << calibrator.percentile(calibrator.chosen()) << " microseconds for a budget of " << calibrator.budget() << " microseconds (p99 per cpu-used: " << measured.str() << ")" << std::endl;
+            }
+        }
+        return (0 < out.size);
+    }
+
+   private:
+    const Settings m_settings;
+    std::function<void(opendlv::video::EncoderStatus &, uint32_t)> m_delegate;
+};
+
+#endif
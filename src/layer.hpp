@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LAYER_HPP
+#define LAYER_HPP
+
+#include "opendlv-video-message-set.hpp"
+#include "calibrator.hpp"
+#include "container-writer.hpp"
+#include "encoded-frame.hpp"
+#include "frame-pool.hpp"
+#include "image-reading-fragments.hpp"
+#include "pacer.hpp"
+#include "presentation-clock.hpp"
+#include "rtp-sender.hpp"
+#include "source.hpp"
+#include "spsc-queue.hpp"
+#include "vpx-encoder.hpp"
+
+#include <vpx/vpx_encoder.h>
+#include <libyuv.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * One output stream with its own resolution, bitrate, codec, and senderStamp.
+ */
+struct Layer {
+    Layer(uint32_t w, uint32_t h, uint32_t b, bool isVP8, uint32_t stamp, uint32_t spatial, uint32_t temporal, bool scaled, uint32_t poolSize, uint32_t mtu) noexcept
+        : width{w}
+        , height{h}
+        , bitrate{b}
+        , vp8{isVP8}
+        , senderStamp{stamp}
+        , spatialLayers{spatial}
+        , temporalLayers{temporal}
+        , scaledFrame{w, h, (scaled ? 1u : 0u)}
+        , encodedFrames(poolSize)
+        , capturedFrames{poolSize}
+        , freeEncodedFrames{poolSize}
+        , encodedFrameQueue{poolSize}
+        , fragmenter{mtu} {
+        for (uint32_t i{0}; i < poolSize; i++) {
+            // Size of an uncompressed I420 frame and some headroom; VpxEncoder grows it for larger frames.
+            encodedFrames[i].data.resize(width * height * 3 / 2 + 65536, '0');
+            freeEncodedFrames.push(i);
+        }
+    }
+
+    const uint32_t width;
+    const uint32_t height;
+    uint32_t bitrate;
+    const bool vp8;
+    const uint32_t senderStamp;
+    const uint32_t spatialLayers;
+    const uint32_t temporalLayers;
+    uint32_t source{0};  // Index of the shared memory area.
+    libyuv::FilterMode filter{libyuv::kFilterBox};  // Filter of the source for downscaling.
+
+    // Frame interval until the first two frames are captured.
+    static constexpr int64_t INITIAL_FRAME_INTERVAL{50000};
+
+    // Size of the given spatial layer as computed by libvpx for a scaling factor of 1/2^n.
+    uint32_t spatialWidth(uint32_t layer) const noexcept {
+        const uint32_t W{width >> (spatialLayers - 1 - layer)};
+        return (W == width) ? W : W + W % 2;
+    }
+    uint32_t spatialHeight(uint32_t layer) const noexcept {
+        const uint32_t H{height >> (spatialLayers - 1 - layer)};
+        return (H == height) ? H : H + H % 2;
+    }
+
+    FramePool scaledFrame;  // Only allocated when the layer's size differs from the source.
+    VpxEncoder encoder{};
+    PresentationClock clock{INITIAL_FRAME_INTERVAL};
+    std::unique_ptr<Calibrator> calibrator{};  // Only set with --calibrate.
+    uint32_t frameCounter{0};
+    uint32_t framesSinceKeyFrame{0};
+    uint32_t gop{0};
+    int32_t cpuUsed{0};
+    int64_t lastEncodedPts{0};
+    uint64_t unchangedFramesSkipped{0};
+    uint64_t unchangedFramesEncoded{0};
+
+    // Received from the OD4Session's thread; applied before encoding the next frame.
+    SPSCQueue<opendlv::video::EncoderControl> controls{8};
+    std::atomic<bool> keyFrameRequested{false};
+
+    // Returns the ratio between the largest and the average frame size over the last frames.
+    double peakToMean(uint32_t size) noexcept {
+        recentFrameSizes[numberOfRecentFrames % FRAME_SIZE_WINDOW] = size;
+        numberOfRecentFrames++;
+        const uint32_t N{(numberOfRecentFrames < FRAME_SIZE_WINDOW) ? numberOfRecentFrames : FRAME_SIZE_WINDOW};
+        uint64_t sum{0};
+        uint32_t peak{0};
+        for (uint32_t i{0}; i < N; i++) {
+            sum += recentFrameSizes[i];
+            peak = std::max(peak, recentFrameSizes[i]);
+        }
+        return (0 < sum) ? static_cast<double>(peak) * N / static_cast<double>(sum) : 0.0;
+    }
+    static constexpr uint32_t FRAME_SIZE_WINDOW{100};
+    uint32_t recentFrameSizes[FRAME_SIZE_WINDOW]{};
+    uint32_t numberOfRecentFrames{0};
+
+    // Indices into the source's frame pool and into encodedFrames are handed between the
+    // threads; every queue has exactly one producer and one consumer as the frames of a
+    // layer are only encoded by the worker that set busy.
+    std::vector<EncodedFrame> encodedFrames;
+    SPSCQueue<CapturedFrame> capturedFrames;     // capture -> encode
+    SPSCQueue<uint32_t> freeEncodedFrames;       // publish -> encode
+    SPSCQueue<uint32_t> encodedFrameQueue;       // encode -> publish
+    std::atomic<bool> busy{false};
+    uint32_t encodedFrameIndex{0};
+    bool hasEncodedFrame{false};
+
+    Fragmenter fragmenter;
+    std::unique_ptr<IvfWriter> ivf{};    // Only set with --ivf.
+    std::unique_ptr<WebmWriter> webm{};  // Only set with --webm.
+    std::unique_ptr<RtpSender> rtp{};    // Only set with --rtp.
+    std::unique_ptr<Pacer> pacer{};      // Only set with --pacing.
+    char imageReadingFields[32]{};
+    uint32_t frameSizes[VPX_SS_MAX_LAYERS]{};
+};
+
+#endif
@@ -17,55 +17,265 @@
 
 #include "cluon-complete.hpp"
 #include "opendlv-standard-message-set.hpp"
+#include "opendlv-video-message-set.hpp"
+#include "container-writer.hpp"
+#include "duplicate-frame-detector.hpp"
+#include "encoded-frame-ring.hpp"
+#include "envelope-sender.hpp"
+#include "file-writer.hpp"
+#include "frame-capture.hpp"
+#include "frame-transform.hpp"
+#include "frame-waiter.hpp"
+#include "image-reading-fragments.hpp"
+#include "input-format.hpp"
+#include "layer.hpp"
+#include "layer-encoder.hpp"
+#include "pacer.hpp"
+#include "pipeline.hpp"
+#include "publisher.hpp"
+#include "rtp-sender.hpp"
+#include "source.hpp"
+#include "static-scene-detector.hpp"
 
-#include <vpx/vpx_encoder.h>
-#include <vpx/vp8cx.h>
+#include <pthread.h>
+#include <signal.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <cstring>
 #include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <thread>
 #include <vector>
 
 int32_t main(int32_t argc, char **argv) {
     int32_t retCode{1};
     auto commandlineArguments = cluon::getCommandlineArguments(argc, argv);
     if ( (0 == commandlineArguments.count("cid")) ||
-         ( (0 == commandlineArguments.count("vp8")) && (0 == commandlineArguments.count("vp9")) ) ||
-         ( (1 == commandlineArguments.count("vp8")) && (1 == commandlineArguments.count("vp9")) ) ||
+         ( (0 == commandlineArguments.count("layers")) && (0 == commandlineArguments.count("codec")) && ( (0 == commandlineArguments.count("vp8")) && (0 == commandlineArguments.count("vp9")) ) ) ||
+         ( (0 == commandlineArguments.count("layers")) && ( (1 == commandlineArguments.count("vp8")) && (1 == commandlineArguments.count("vp9")) ) ) ||
          (0 == commandlineArguments.count("name")) ||
          (0 == commandlineArguments.count("width")) ||
          (0 == commandlineArguments.count("height")) ) {
         std::cerr << argv[0] << " attaches to an I420-formatted image residing in a shared memory area to convert it into a corresponding VPX (VP8 or VP9) frame for publishing to a running OD4 session." << std::endl;
-        std::cerr << "Usage:   " << argv[0] << " --cid=<OpenDaVINCI session> --name=<name of shared memory area> --width=<width> --height=<height> [--gop=<GOP>] [--bitrate=<bitrate>] [--verbose] [--id=<identifier in case of multiple instances]" << std::endl;
+        std::cerr << "Usage:   " << argv[0] << " --cid=<OpenDaVINCI session> --name=<name of shared memory area> --width=<width> --height=<height> [--gop=<GOP>] [--bitrate=<bitrate>] [--copy-out] [--pipeline] [--mtu=<bytes>] [--layers=<width>x<height>:<bitrate>:<vp8|vp9>:<senderStamp>[,...]] [--svc=<spatial layers>] [--svc-bitrates=<bitrate>[,...]] [--temporal-layers=<layers>] [--threads=<threads>] [--tile-columns=<log2>] [--row-mt=<0|1>] [--frame-parallel=<0|1>] [--calibrate=<frames>] [--keyframe-requests] [--keyframe-request-interval=<ms>] [--intra-refresh] [--static-threshold=<difference>] [--static-mode=<drop|cheap>] [--static-heartbeat=<ms>] [--dedup-hash] [--fps=<Hz>] [--stale-timeout=<ms>] [--ring=<name>] [--ring-slots=<frames>] [--rec=<file>] [--rec-max-size=<MB>] [--rec-max-duration=<s>] [--ivf=<file>] [--webm=<file>] [--rtp=<address>:<port>] [--rtp-mtu=<bytes>] [--rtp-payload-type=<96..127>] [--pacing=<fraction>] [--fec=<fragments>] [--fec-keyframe=<fragments>] [--codec=<vp8|vp9>[,...]] [--workers=<threads>] [--input-format=<format>] [--stride=<bytes>] [--plane-height=<rows>] [--crop=<width>x<height>+<x>+<y>] [--scale=<width>x<height>] [--filter=<none|linear|bilinear|box>] [--rotate=<0|90|180|270>] [--flip=<horizontal|vertical>] [--verbose] [--id=<identifier in case of multiple instances]" << std::endl;
         std::cerr << "         --vp8:     use VP8 encoder" << std::endl;
         std::cerr << "         --vp9:     use VP9 encoder" << std::endl;
         std::cerr << "         --cid:     CID of the OD4Session to send VP8 or VP9 frames" << std::endl;
         std::cerr << "         --id:      when using several instances, this identifier is used as senderStamp" << std::endl;
-        std::cerr << "         --name:    name of the shared memory area to attach" << std::endl;
+        std::cerr << "         --name:    name of the shared memory area to attach; a comma-separated list encodes several areas in one process" << std::endl;
         std::cerr << "         --width:   width of the frame" << std::endl;
         std::cerr << "         --height:  height of the frame" << std::endl;
-        std::cerr << "         --gop:     optional: length of group of pictures (default = 10)" << std::endl;
+        std::cerr << "                    with several areas, --width, --height, --id, --bitrate, --codec, --input-format, --stride, --plane-height, --crop, --scale, --filter, --rotate, and --flip are comma-separated lists with one entry per area; a single entry applies to all areas (except --id, which defaults to 0, 1, ...)" << std::endl;
+        std::cerr << "         --codec:   optional: vp8 or vp9 instead of --vp8 or --vp9" << std::endl;
+        std::cerr << "         --input-format: optional: layout of the frame in the shared memory: i420, nv12, yuyv, uyvy, rgb24, bgr24, rgba, or bgra (default: i420); all but i420 (and nv12 from libvpx 1.8.1 on) are converted into I420 when copied out (implies --copy-out)" << std::endl;
+        std::cerr << "         --stride:  optional: bytes per row of the first plane (default: tightly packed)" << std::endl;
+        std::cerr << "         --plane-height: optional: rows per plane including padding (default: height)" << std::endl;
+        std::cerr << "         --crop:    optional: encode only the given region of the frame; x and y must be even (implies --copy-out)" << std::endl;
+        std::cerr << "         --scale:   optional: scale the (cropped) frame to the given size after rotation (implies --copy-out)" << std::endl;
+        std::cerr << "         --filter:  optional: filter for --scale and for downscaling to --layers from fastest to best: none, linear, bilinear, or box (default: box)" << std::endl;
+        std::cerr << "         --rotate:  optional: rotate the frame clockwise by 90, 180, or 270 degrees (implies --copy-out)" << std::endl;
+        std::cerr << "         --flip:    optional: mirror the frame horizontally or vertically before rotating it (implies --copy-out)" << std::endl;
+        std::cerr << "         --gop:     optional: length of group of pictures (default = 10; 300 with --keyframe-requests; 0 = none with --intra-refresh)" << std::endl;
         std::cerr << "         --bitrate: optional: desired bitrate (default: 800,000, min: 50,000 max: 5,000,000)" << std::endl;
+        std::cerr << "         --copy-out: copy the frame from the shared memory and unlock it before encoding" << std::endl;
+        std::cerr << "         --pipeline: capture, encode, and publish frames in separate threads (implies --copy-out)" << std::endl;
+        std::cerr << "         --mtu:     optional: maximum size of a UDP datagram; larger frames are sent as fragments (default: 65,507)" << std::endl;
+        std::cerr << "         --layers:  optional: simulcast; encode the frame into several layers, each downscaled from the source and encoded in its own thread (replaces --vp8/--vp9, --bitrate, and --id)" << std::endl;
+        std::cerr << "         --svc:     optional: encode VP9 frames with 2 or 3 spatial layers, each half the size of the next one, and publish them as separate frames (default: 1)" << std::endl;
+        std::cerr << "         --svc-bitrates: optional: bitrates of the spatial layers from the lowest one; default: the bitrate is split 1:2 (:4) between the layers" << std::endl;
+        std::cerr << "         --temporal-layers: optional: encode with 2 or 3 temporal layers so that frames of the upper layers can be dropped without breaking decoding (default: 1)" << std::endl;
+        std::cerr << "         --threads: optional: encoder threads per layer (default: number of cores divided by number of layers)" << std::endl;
+        std::cerr << "         --workers: optional: threads that share the encoding of all layers with --pipeline, --layers, or several areas (default: number of layers, at most number of cores)" << std::endl;
+        std::cerr << "         --tile-columns: optional: VP9 only; log2 of the number of tile columns (default: one per thread, each at least 256 pixels wide)" << std::endl;
+        std::cerr << "         --row-mt:  optional: VP9 only; 1 to encode rows of superblocks in parallel (default: 1 when using more than one thread)" << std::endl;
+        std::cerr << "         --frame-parallel: optional: VP9 only; 1 to allow decoders to decode frames in parallel at a small cost in compression (default: 0)" << std::endl;
+        std::cerr << "         --calibrate: optional: choose cpu-used at startup by encoding the given number of live frames per candidate and taking the slowest (best quality) one whose 99th percentile of the encoding time fits into the frame interval" << std::endl;
+        std::cerr << "         --keyframe-requests: encode keyframes on KeyFrameRequest messages from subscribers; --gop is then only a safety interval" << std::endl;
+        std::cerr << "         --keyframe-request-interval: optional: minimum time between two accepted requests of one subscriber in milliseconds (default: 1000)" << std::endl;
+        std::cerr << "         --static-threshold: optional: treat frames as unchanged whose luma, decimated by 8, differs from the previous frame by at most this mean absolute difference (e.g., 1.5)" << std::endl;
+        std::cerr << "         --static-mode: optional: drop unchanged frames or encode them at the fastest speed (cheap) (default: drop)" << std::endl;
+        std::cerr << "         --static-heartbeat: optional: with --static-mode=drop, encode an unchanged frame at least every given milliseconds (default: 1000)" << std::endl;
+        std::cerr << "         --dedup-hash: optional: besides an unchanged time stamp of the shared memory, require an unchanged hash of every eighth row to skip a frame as duplicate" << std::endl;
+        std::cerr << "         --fps:     optional: encode the newest frame at the given fixed rate regardless of the producer's rate; older frames are skipped" << std::endl;
+        std::cerr << "         --stale-timeout: optional: report the source as stale with opendlv.video.SourceStatus when no frame arrived for the given milliseconds (default: 1000 with --fps)" << std::endl;
+        std::cerr << "         --ring:    optional: also write the encoded frames of all layers with their time stamps into a ring in a shared memory area of the given name for consumers on the same host (see src/encoded-frame-ring.hpp)" << std::endl;
+        std::cerr << "         --ring-slots: optional: number of frames in the ring (default: 16)" << std::endl;
+        std::cerr << "         --rec:     optional: also record the published Envelopes into the given .rec file, written by a thread of its own; Envelopes are dropped rather than delaying the encoding when the disk falls behind" << std::endl;
+        std::cerr << "         --rec-max-size: optional: continue recording in the next numbered file after the given number of megabytes (default: 0 = never)" << std::endl;
+        std::cerr << "         --rec-max-duration: optional: continue recording in the next numbered file after the given number of seconds (default: 0 = never)" << std::endl;
+        std::cerr << "         --ivf:     optional: also write the encoded frames into the given IVF file; with several layers, the senderStamp is appended to the name of the file (e.g., video-1.ivf)" << std::endl;
+        std::cerr << "         --webm:    optional: also write the encoded frames into the given WebM file; with several layers, the senderStamp is appended to the name of the file (e.g., video-1.webm)" << std::endl;
+        std::cerr << "         --rtp:     optional: also send every layer as RTP stream (RFC 7741 for VP8, RFC 9628 for VP9) to the given IPv4 address and port; further layers use the following even ports (port + 2, port + 4, ...); the SDP description is printed at startup" << std::endl;
+        std::cerr << "         --rtp-mtu: optional: maximum size of an RTP packet (default: 1200)" << std::endl;
+        std::cerr << "         --rtp-payload-type: optional: RTP payload type (default: 96)" << std::endl;
+        std::cerr << "         --pacing:  optional: spread the datagrams of every frame over the given fraction of the frame interval (e.g., 0.5) at a rate derived from the layer's target bitrate instead of sending them in one burst (default: 0 = off); with several layers, the fractions add up" << std::endl;
+        std::cerr << "         --fec:     optional: protect fragmented frames with one XOR parity fragment per group of the given number of fragments (at least 2), which restores one lost fragment per group at an overhead of 1/<fragments> (default: 0 = off)" << std::endl;
+        std::cerr << "         --fec-keyframe: optional: group size for keyframes, e.g., smaller for stronger protection (default: as --fec)" << std::endl;
+        std::cerr << "         --intra-refresh: spread intra-coded blocks over the frames instead of encoding periodic keyframes; --gop is then only a safety interval (default: 0 = none)" << std::endl;
         std::cerr << "         --verbose: print encoding information" << std::endl;
         std::cerr << "Example: " << argv[0] << " --cid=111 --name=data --width=640 --height=480 --verbose" << std::endl;
+        std::cerr << "         " << argv[0] << " --cid=111 --name=data --width=1280 --height=720 --layers=1280x720:2000000:vp9:0,320x180:200000:vp8:1" << std::endl;
+        std::cerr << "         " << argv[0] << " --cid=111 --name=front,rear --width=1280,640 --height=720,480 --id=0,1 --bitrate=2000000,800000 --vp9" << std::endl;
     }
     else {
-        const std::string NAME{commandlineArguments["name"]};
+        // SIGINT and SIGTERM are only received by a thread waiting for them so that the program
+        // stops orderly and the archives are closed; all threads inherit this mask.
+        sigset_t stopSignals;
+        ::sigemptyset(&stopSignals);
+        ::sigaddset(&stopSignals, SIGINT);
+        ::sigaddset(&stopSignals, SIGTERM);
+        ::pthread_sigmask(SIG_BLOCK, &stopSignals, nullptr);
+
+        // Returns the comma-separated values of the given argument; stringtoolbox::split only
+        // returns values for strings that contain the delimiter.
+        auto list = [&commandlineArguments](const std::string &key) {
+            const std::string VALUE{commandlineArguments[key]};
+            std::vector<std::string> values{stringtoolbox::split(VALUE, ',')};
+            if (values.empty() && !VALUE.empty()) {
+                values.push_back(VALUE);
+            }
+            return values;
+        };
+        // Several shared memory areas can be given as list; --width, --height, --id, --bitrate,
+        // and --codec then have one entry per area; all but --id can have one for all areas.
+        const std::vector<std::string> NAMES{list("name")};
+        const uint32_t NUMBER_OF_SOURCES{static_cast<uint32_t>(NAMES.size())};
+        for (auto key : {"width", "height", "id", "bitrate", "codec", "input-format", "stride", "plane-height", "crop", "scale", "filter", "rotate", "flip"}) {
+            // As senderStamps need to differ, a single --id cannot be shared by several areas.
+            const uint32_t N{static_cast<uint32_t>(list(key).size())};
+            const uint32_t SHARED{(0 == std::strcmp(key, "id")) ? 0u : 1u};
+            if ( (SHARED < N) && (NUMBER_OF_SOURCES != N) ) {
+                std::cerr << "[opendlv-video-vpx-encoder]: --" << key << " needs one entry for each of the " << NUMBER_OF_SOURCES << " shared memory areas." << std::endl;
+                return retCode;
+            }
+        }
+        auto valueOf = [&list](const std::string &key, uint32_t source) {
+            const std::vector<std::string> VALUES{list(key)};
+            return VALUES.empty() ? std::string() : VALUES[(1 == VALUES.size()) ? 0 : source];
+        };
+        auto numberOf = [&valueOf](const std::string &key, uint32_t source) {
+            const std::string VALUE{valueOf(key, source)};
+            return VALUE.empty() ? 0u : static_cast<uint32_t>(std::stoi(VALUE));
+        };
+        auto inputFormatOf = [&valueOf](uint32_t source) {
+            const std::string VALUE{valueOf("input-format", source)};
+            return VALUE.empty() ? std::string("i420") : VALUE;
+        };
+        // Crop (<width>x<height>+<x>+<y>), scale (<width>x<height> after rotation), filter,
+        // rotation, and flip of the frames of the given shared memory area; returns false
+        // for malformed values.
+        auto geometryOf = [&valueOf, &numberOf](uint32_t source, FrameTransform::Geometry &geometry) {
+            const std::string CROP{valueOf("crop", source)};
+            if (!CROP.empty()) {
+                auto fields = stringtoolbox::split(CROP, '+');
+                auto size = (0 < fields.size() ? stringtoolbox::split(fields[0], 'x') : std::vector<std::string>());
+                if ( (3 != fields.size()) || (2 != size.size()) ) {
+                    return false;
+                }
+                geometry.cropWidth = static_cast<uint32_t>(std::stoi(size[0]));
+                geometry.cropHeight = static_cast<uint32_t>(std::stoi(size[1]));
+                geometry.cropX = static_cast<uint32_t>(std::stoi(fields[1]));
+                geometry.cropY = static_cast<uint32_t>(std::stoi(fields[2]));
+            }
+            const std::string SCALE{valueOf("scale", source)};
+            if (!SCALE.empty()) {
+                auto size = stringtoolbox::split(SCALE, 'x');
+                if (2 != size.size()) {
+                    return false;
+                }
+                geometry.width = static_cast<uint32_t>(std::stoi(size[0]));
+                geometry.height = static_cast<uint32_t>(std::stoi(size[1]));
+            }
+            const std::string FILTER{valueOf("filter", source)};
+            if ( !FILTER.empty() && ("none" != FILTER) && ("linear" != FILTER) && ("bilinear" != FILTER) && ("box" != FILTER) ) {
+                return false;
+            }
+            geometry.filter = ("none" == FILTER) ? libyuv::kFilterNone :
+                              ("linear" == FILTER) ? libyuv::kFilterLinear :
+                              ("bilinear" == FILTER) ? libyuv::kFilterBilinear : libyuv::kFilterBox;
+            // A vertical flip is a horizontal one rotated by 180 degrees.
+            const std::string FLIP{valueOf("flip", source)};
+            if ( !FLIP.empty() && ("horizontal" != FLIP) && ("vertical" != FLIP) ) {
+                return false;
+            }
+            geometry.mirror = !FLIP.empty();
+            geometry.rotation = (numberOf("rotate", source) + (("vertical" == FLIP) ? 180 : 0)) % 360;
+            return true;
+        };
+
+        // Frames that libvpx cannot read from the shared memory are converted into I420 when copied
+        // out, possibly together with cropping, scaling, and rotating them.
+        bool transform{false};
+        std::vector<uint32_t> widths;
+        std::vector<uint32_t> heights;
+        for (uint32_t i{0}; i < NUMBER_OF_SOURCES; i++) {
+            const std::string CODEC{valueOf("codec", i)};
+            const InputFormat INPUT{inputFormatOf(i), numberOf("width", i), numberOf("height", i), numberOf("stride", i), numberOf("plane-height", i)};
+            FrameTransform::Geometry geometry;
+            if ( (0 == numberOf("width", i)) || (0 == numberOf("height", i)) || (!CODEC.empty() && ("vp8" != CODEC) && ("vp9" != CODEC)) || !INPUT.valid() || !geometryOf(i, geometry) ) {
+                std::cerr << "[opendlv-video-vpx-encoder]: Invalid --width, --height, --codec, --input-format, --stride, --plane-height, --crop, --scale, --filter, --rotate, or --flip for '" << NAMES[i] << "'." << std::endl;
+                return retCode;
+            }
+            const FrameTransform TRANSFORM{INPUT, numberOf("width", i), numberOf("height", i), geometry};
+            if (!TRANSFORM.valid()) {
+                std::cerr << "[opendlv-video-vpx-encoder]: --crop must be within the frame and start at even coordinates, --rotate must be 0, 90, 180, or 270 for '" << NAMES[i] << "'." << std::endl;
+                return retCode;
+            }
+            transform |= !INPUT.wrappable() || !TRANSFORM.identity();
+            widths.push_back(TRANSFORM.width());
+            heights.push_back(TRANSFORM.height());
+        }
+        const bool MULTI_CAMERA{1 < NUMBER_OF_SOURCES};
         const bool VP8{commandlineArguments.count("vp8") != 0};
-        const bool VP9{commandlineArguments.count("vp9") != 0};
-        const uint32_t WIDTH{static_cast<uint32_t>(std::stoi(commandlineArguments["width"]))};
-        const uint32_t HEIGHT{static_cast<uint32_t>(std::stoi(commandlineArguments["height"]))};
-        const uint32_t GOP_DEFAULT{10};
+        const uint32_t WIDTH{widths[0]};
+        const uint32_t HEIGHT{heights[0]};
+        const bool KEYFRAME_REQUESTS{commandlineArguments.count("keyframe-requests") != 0};
+        const int64_t KEYFRAME_REQUEST_INTERVAL{1000 * ((commandlineArguments["keyframe-request-interval"].size() != 0) ? std::stoi(commandlineArguments["keyframe-request-interval"]) : 1000)};
+        const bool INTRA_REFRESH{commandlineArguments.count("intra-refresh") != 0};
+        const uint32_t GOP_DEFAULT{INTRA_REFRESH ? 0u : (KEYFRAME_REQUESTS ? 300u : 10u)};
         const uint32_t GOP{(commandlineArguments["gop"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["gop"])) : GOP_DEFAULT};
         const uint32_t BITRATE_MIN{50000};
         const uint32_t BITRATE_DEFAULT{800000};
         const uint32_t BITRATE_MAX{5000000};
-        const uint32_t BITRATE{(commandlineArguments["bitrate"].size() != 0) ? std::min(std::max(static_cast<uint32_t>(std::stoi(commandlineArguments["bitrate"])), BITRATE_MIN), BITRATE_MAX) : BITRATE_DEFAULT};
         const bool VERBOSE{commandlineArguments.count("verbose") != 0};
+        const bool PIPELINE{commandlineArguments.count("pipeline") != 0};
+        const bool COPY_OUT{PIPELINE || (commandlineArguments.count("copy-out") != 0)};
+        const uint32_t MTU{(commandlineArguments["mtu"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["mtu"])) : Fragmenter::MAX_DATAGRAM_SIZE};
         const uint32_t CPUUSED{(commandlineArguments["cpu-used"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["cpu-used"])) : 5};
-	const uint32_t ID{(commandlineArguments["id"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["id"])) : 0};
-        const uint32_t THREADS{(commandlineArguments["threads"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["threads"])) : 4};
+        const double STATIC_THRESHOLD{(commandlineArguments["static-threshold"].size() != 0) ? std::stod(commandlineArguments["static-threshold"]) : -1.0};
+        const bool STATIC_CHEAP{"cheap" == commandlineArguments["static-mode"]};
+        const double FPS{(commandlineArguments["fps"].size() != 0) ? std::stod(commandlineArguments["fps"]) : 0.0};
+        const bool TIMED_WAIT{(0 < FPS) || (commandlineArguments["stale-timeout"].size() != 0)};
+        const std::chrono::milliseconds STALE_TIMEOUT{(commandlineArguments["stale-timeout"].size() != 0) ? std::stoi(commandlineArguments["stale-timeout"]) : 1000};
+        const bool DEDUP_HASH{commandlineArguments.count("dedup-hash") != 0};
+        const std::string RING{commandlineArguments["ring"]};
+        const uint32_t RING_SLOTS{(commandlineArguments["ring-slots"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["ring-slots"])) : 16};
+        const std::string REC{commandlineArguments["rec"]};
+        const uint64_t REC_MAX_SIZE{1024 * 1024 * ((commandlineArguments["rec-max-size"].size() != 0) ? std::stoull(commandlineArguments["rec-max-size"]) : 0)};
+        const std::chrono::seconds REC_MAX_DURATION{(commandlineArguments["rec-max-duration"].size() != 0) ? std::stoi(commandlineArguments["rec-max-duration"]) : 0};
+        const std::string IVF{commandlineArguments["ivf"]};
+        const std::string WEBM{commandlineArguments["webm"]};
+        const std::string RTP{commandlineArguments["rtp"]};
+        const double PACING{(commandlineArguments["pacing"].size() != 0) ? std::stod(commandlineArguments["pacing"]) : 0.0};
+        const uint32_t FEC{(commandlineArguments["fec"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["fec"])) : 0};
+        const uint32_t FEC_KEYFRAME{(commandlineArguments["fec-keyframe"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["fec-keyframe"])) : FEC};
+        const uint32_t RTP_MTU{(commandlineArguments["rtp-mtu"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["rtp-mtu"])) : 1200};
+        const uint8_t RTP_PAYLOAD_TYPE{static_cast<uint8_t>((commandlineArguments["rtp-payload-type"].size() != 0) ? std::stoi(commandlineArguments["rtp-payload-type"]) : 96)};
+        const int64_t STATIC_HEARTBEAT{1000 * ((commandlineArguments["static-heartbeat"].size() != 0) ? std::stoi(commandlineArguments["static-heartbeat"]) : 1000)};
+        const uint32_t CALIBRATE{(commandlineArguments["calibrate"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["calibrate"])) : 0};
+        const uint32_t THREADS{(commandlineArguments["threads"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["threads"])) : 0};
+        const uint32_t WORKERS{(commandlineArguments["workers"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["workers"])) : 0};
+        const int32_t TILE_COLUMNS{(commandlineArguments["tile-columns"].size() != 0) ? std::stoi(commandlineArguments["tile-columns"]) : -1};
+        const int32_t ROW_MT{(commandlineArguments["row-mt"].size() != 0) ? std::stoi(commandlineArguments["row-mt"]) : -1};
+        const uint32_t FRAME_PARALLEL{(commandlineArguments["frame-parallel"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["frame-parallel"])) : 0};
         const uint32_t PROFILE{(commandlineArguments["profile"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["profile"])) : 0};
         const std::string STEREO_MODE{(commandlineArguments["stereo-mode"].size() != 0) ? commandlineArguments["stereo-mode"] : "mono"};
         const uint32_t LAG_IN_FRAMES{(commandlineArguments["lag-in-frames"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["lag-in-frames"])) : 0};
@@ -83,164 +293,404 @@ int32_t main(int32_t argc, char **argv) {
         const uint32_t KF_MODE{(commandlineArguments["kf-mode"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["kf-mode"])) : 0};
         const uint32_t KF_MIN_DIST{(commandlineArguments["kf-min-dist"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["kf-min-dist"])) : 0};
         const uint32_t KF_MAX_DIST{(commandlineArguments["kf-max-dist"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["kf-max-dist"])) : 99999};
+        const uint32_t SVC_MAX{3};
+        const uint32_t SVC{(commandlineArguments["svc"].size() != 0) ? std::min(std::max(static_cast<uint32_t>(std::stoi(commandlineArguments["svc"])), 1u), SVC_MAX) : 1};
+        const uint32_t TEMPORAL_LAYERS_MAX{LayerEncoder::TEMPORAL_LAYERS_MAX};
+        const uint32_t TEMPORAL_LAYERS{(commandlineArguments["temporal-layers"].size() != 0) ? std::min(std::max(static_cast<uint32_t>(std::stoi(commandlineArguments["temporal-layers"])), 1u), TEMPORAL_LAYERS_MAX) : 1};
+        std::vector<uint32_t> svcBitrates;
+        for (auto b : list("svc-bitrates")) {
+            svcBitrates.push_back(static_cast<uint32_t>(std::stoi(b)));
+        }
+        if (!svcBitrates.empty() && (SVC != svcBitrates.size())) {
+            std::cerr << "[opendlv-video-vpx-encoder]: --svc-bitrates needs one bitrate for each of the " << SVC << " spatial layers." << std::endl;
+            return retCode;
+        }
         
-        std::unique_ptr<cluon::SharedMemory> sharedMemory(new cluon::SharedMemory{NAME});
-        if (sharedMemory && sharedMemory->valid()) {
-            std::clog << "[opendlv-video-vpx-encoder]: Attached to '" << sharedMemory->name() << "' (" << sharedMemory->size() << " bytes)." << std::endl;
+        // Output layers: either given as list for simulcast or one layer per shared memory area from --width, --height, --bitrate, --vp8/--vp9/--codec, and --id.
+        struct LayerSpecification {
+            uint32_t width;
+            uint32_t height;
+            uint32_t bitrate;
+            bool vp8;
+            uint32_t senderStamp;
+            uint32_t spatialLayers;
+            uint32_t temporalLayers;
+            uint32_t source;
+        };
+        const bool SIMULCAST{commandlineArguments["layers"].size() != 0};
+        if (SIMULCAST && MULTI_CAMERA) {
+            std::cerr << "[opendlv-video-vpx-encoder]: --layers can only be used with one shared memory area." << std::endl;
+            return retCode;
+        }
+        std::vector<LayerSpecification> layerSpecifications;
+        if (SIMULCAST) {
+            for (auto l : list("layers")) {
+                auto fields = stringtoolbox::split(l, ':');
+                auto size = (0 < fields.size() ? stringtoolbox::split(fields[0], 'x') : std::vector<std::string>());
+                if ( (4 != fields.size()) || (2 != size.size()) || (("vp8" != fields[2]) && ("vp9" != fields[2])) ) {
+                    std::cerr << "[opendlv-video-vpx-encoder]: Invalid layer '" << l << "'; expected <width>x<height>:<bitrate>:<vp8|vp9>:<senderStamp>." << std::endl;
+                    return retCode;
+                }
+                const uint32_t W{static_cast<uint32_t>(std::stoi(size[0]))};
+                const uint32_t H{static_cast<uint32_t>(std::stoi(size[1]))};
+                if ( (W > WIDTH) || (H > HEIGHT) || (0 == W) || (0 == H) ) {
+                    std::cerr << "[opendlv-video-vpx-encoder]: Layer '" << l << "' must not be larger than " << WIDTH << "x" << HEIGHT << "." << std::endl;
+                    return retCode;
+                }
+                const uint32_t B{std::min(std::max(static_cast<uint32_t>(std::stoi(fields[1])), BITRATE_MIN), BITRATE_MAX)};
+                layerSpecifications.push_back(LayerSpecification{W, H, B, ("vp8" == fields[2]), static_cast<uint32_t>(std::stoi(fields[3])), ("vp8" == fields[2]) ? 1 : SVC, TEMPORAL_LAYERS, 0});
+            }
+        }
+        else {
+            for (uint32_t i{0}; i < NUMBER_OF_SOURCES; i++) {
+                const std::string CODEC{valueOf("codec", i)};
+                const bool IS_VP8{CODEC.empty() ? VP8 : ("vp8" == CODEC)};
+                const std::string B{valueOf("bitrate", i)};
+                const std::string S{valueOf("id", i)};
+                layerSpecifications.push_back(LayerSpecification{widths[i],
+                                                                 heights[i],
+                                                                 B.empty() ? BITRATE_DEFAULT : std::min(std::max(static_cast<uint32_t>(std::stoi(B)), BITRATE_MIN), BITRATE_MAX),
+                                                                 IS_VP8,
+                                                                 S.empty() ? i : static_cast<uint32_t>(std::stoi(S)),
+                                                                 IS_VP8 ? 1 : SVC,
+                                                                 TEMPORAL_LAYERS,
+                                                                 i});
+            }
+        }
+        // Receivers tell the layers apart by their senderStamp.
+        for (std::size_t i{0}; i < layerSpecifications.size(); i++) {
+            for (std::size_t j{i + 1}; j < layerSpecifications.size(); j++) {
+                if (layerSpecifications[i].senderStamp == layerSpecifications[j].senderStamp) {
+                    std::cerr << "[opendlv-video-vpx-encoder]: SenderStamp " << layerSpecifications[i].senderStamp << " is used by more than one layer; " << (SIMULCAST ? "--layers" : "--id") << " needs a distinct senderStamp for each layer." << std::endl;
+                    return retCode;
+                }
+            }
+        }
+        if (!svcBitrates.empty()) {
+            // Explicit bitrates of the spatial layers replace the bitrate of VP9 layers.
+            for (auto &l : layerSpecifications) {
+                l.bitrate = (1 < l.spatialLayers) ? std::accumulate(svcBitrates.begin(), svcBitrates.end(), 0u) : l.bitrate;
+            }
+        }
+        if ((1 < SVC) && (layerSpecifications.end() != std::find_if(layerSpecifications.begin(), layerSpecifications.end(), [](const LayerSpecification &l){ return l.vp8; }))) {
+            std::clog << "[opendlv-video-vpx-encoder]: Spatial layers are only supported for VP9; VP8 is encoded with one layer." << std::endl;
+        }
 
-            vpx_codec_iface_t *encoderAlgorithm{(VP8 ? &vpx_codec_vp8_cx_algo : &vpx_codec_vp9_cx_algo)};
+        // Frames to hold a copy from the shared memory when encoding outside of the lock;
+        // in threaded mode, every frame is shared by all layers of its shared memory area.
+        const bool THREADED{PIPELINE || SIMULCAST || MULTI_CAMERA};
+        const bool COPY{COPY_OUT || THREADED || transform};
+        const uint32_t FRAME_POOL_SIZE{THREADED ? 3u : 1u};
+        const uint32_t ENCODED_FRAME_POOL_SIZE{THREADED ? 3u : 1u};
 
-            vpx_image_t yuvFrame;
-            if (!vpx_img_wrap(&yuvFrame, VPX_IMG_FMT_I420, WIDTH, HEIGHT, 1, reinterpret_cast<uint8_t*>(sharedMemory->data()))) {
-                std::cerr << "[opendlv-video-vpx-encoder]: Failed to wrap shared memory into vpx_image." << std::endl;
-                return retCode;
+        std::vector<std::unique_ptr<Source> > sources;
+        bool attached{true};
+        for (uint32_t i{0}; i < NUMBER_OF_SOURCES; i++) {
+            FrameTransform::Geometry geometry;
+            geometryOf(i, geometry);
+            std::unique_ptr<Source> source{new Source(NAMES[i], numberOf("width", i), numberOf("height", i), inputFormatOf(i), numberOf("stride", i), numberOf("plane-height", i), geometry, (COPY ? FRAME_POOL_SIZE : 0))};
+            if (source->sharedMemory && source->sharedMemory->valid() && (source->input.size() <= source->sharedMemory->size())) {
+                std::clog << "[opendlv-video-vpx-encoder]: Attached to '" << source->sharedMemory->name() << "' (" << source->sharedMemory->size() << " bytes, " << inputFormatOf(i) << ")." << std::endl;
+            }
+            else if (source->sharedMemory && source->sharedMemory->valid()) {
+                std::cerr << "[opendlv-video-vpx-encoder]: Shared memory '" << NAMES[i] << "' is smaller than the " << source->input.size() << " bytes of a " << inputFormatOf(i) << " frame." << std::endl;
+                attached = false;
+            }
+            else {
+                std::cerr << "[opendlv-video-vpx-encoder]: Failed to attach to shared memory '" << NAMES[i] << "'." << std::endl;
+                attached = false;
+            }
+            sources.push_back(std::move(source));
+        }
+        if (attached) {
+            for (auto &source : sources) {
+                if (!COPY && !source->input.wrap(source->sharedMemory->data(), &source->yuvFrame)) {
+                    std::cerr << "[opendlv-video-vpx-encoder]: Failed to wrap shared memory into vpx_image." << std::endl;
+                    return retCode;
+                }
+                if (COPY && (!source->framePool.valid() || !source->transform.valid())) {
+                    std::cerr << "[opendlv-video-vpx-encoder]: Failed to allocate frame pool." << std::endl;
+                    return retCode;
+                }
+                if (0 <= STATIC_THRESHOLD) {
+                    source->detector.reset(new StaticSceneDetector{source->width, source->height, STATIC_THRESHOLD});
+                }
+                source->duplicates.reset(new DuplicateFrameDetector{DEDUP_HASH});
+                source->waiter.reset(new FrameWaiter{source->sharedMemory});
+                source->nextTick = std::chrono::steady_clock::now();
+                source->lastFrame = source->nextTick;
             }
 
-            struct vpx_codec_enc_cfg parameters;
-            memset(&parameters, 0, sizeof(parameters));
-            vpx_codec_err_t result = vpx_codec_enc_config_default(encoderAlgorithm, &parameters, 0);
-            if (result) {
-                std::cerr << "[opendlv-video-vpx-encoder]: Failed to get default configuration: " << vpx_codec_err_to_string(result) << std::endl;
+            // Encoders share the cores unless the number of threads is given.
+            const uint32_t CORES{std::max(1u, std::thread::hardware_concurrency())};
+            const uint32_t THREADS_PER_LAYER{(0 < THREADS) ? THREADS : std::max(1u, CORES / static_cast<uint32_t>(layerSpecifications.size()))};
+
+            // Frames are sent directly from their buffers to the OD4Session; frames
+            // exceeding the maximum UDP datagram size are sent as fragments.
+            // All layers are sent from one socket.
+            EnvelopeSender sender{"225.0.0." + std::to_string(std::stoi(commandlineArguments["cid"])), 12175};
+            if (!sender.valid()) {
+                std::cerr << "[opendlv-video-vpx-encoder]: Failed to create socket to send frames." << std::endl;
                 return retCode;
             }
 
-            parameters.rc_target_bitrate = BITRATE/1000;
-            parameters.g_w = WIDTH;
-            parameters.g_h = HEIGHT;
-            parameters.g_timebase.num = 1;
-            parameters.g_timebase.den = 20 /* implicitly given from notifyAll trigger*/;
+            // Keyframes on demand: the first request of a subscriber (i.e., when joining) is always
+            // accepted, further ones only after the minimum interval. The time of the last accepted
+            // request per senderStamp and subscriber is only used in the OD4Session's thread. Both
+            // this map and the layers are declared before the OD4Session so that they outlive the
+            // OD4Session's thread; its triggers are only registered once all layers exist.
+            std::map<std::pair<uint32_t, uint32_t>, int64_t> lastKeyFrameRequests;
+            std::vector<std::unique_ptr<Layer> > layers;
+            cluon::OD4Session od4{static_cast<uint16_t>(std::stoi(commandlineArguments["cid"]))};
 
-            // Parameters according to https://www.webmproject.org/docs/encoder-parameters/
-            parameters.g_threads = THREADS;
-            parameters.rc_max_quantizer = (VP8 ? 56 : 52);
+            LayerEncoder::Settings encoderSettings;
+            encoderSettings.bitrateMin = BITRATE_MIN;
+            encoderSettings.bitrateMax = BITRATE_MAX;
+            encoderSettings.threadsPerLayer = THREADS_PER_LAYER;
+            encoderSettings.profile = PROFILE;
+            encoderSettings.lagInFrames = LAG_IN_FRAMES;
+            encoderSettings.dropFrame = DROP_FRAME;
+            encoderSettings.resizeAllowed = RESIZE_ALLOWED;
+            encoderSettings.resizeUp = RESIZE_UP;
+            encoderSettings.resizeDown = RESIZE_DOWN;
+            encoderSettings.endUsage = END_USAGE;
+            encoderSettings.minQuantizer = MIN_Q;
+            encoderSettings.undershootPct = UNDERSHOOT_PCT;
+            encoderSettings.overshootPct = OVERSHOOT_PCT;
+            encoderSettings.bufferSize = BUFFER_SIZE;
+            encoderSettings.bufferInitSize = BUFFER_INIT_SIZE;
+            encoderSettings.bufferOptimalSize = BUFFER_OPTIMAL_SIZE;
+            encoderSettings.kfMode = KF_MODE;
+            encoderSettings.kfMinDist = KF_MIN_DIST;
+            encoderSettings.kfMaxDist = KF_MAX_DIST;
+            encoderSettings.intraRefresh = INTRA_REFRESH;
+            encoderSettings.svcBitrates = svcBitrates;
+            encoderSettings.gop = GOP;
+            encoderSettings.cpuUsed = CPUUSED;
+            encoderSettings.calibrate = CALIBRATE;
+            encoderSettings.tileColumns = TILE_COLUMNS;
+            encoderSettings.rowMt = ROW_MT;
+            encoderSettings.frameParallel = FRAME_PARALLEL;
+            encoderSettings.staticCheap = STATIC_CHEAP;
+            encoderSettings.staticHeartbeat = STATIC_HEARTBEAT;
+            encoderSettings.verbose = VERBOSE;
+            // EncoderControls are acknowledged from the encoding thread of their layer.
+            LayerEncoder layerEncoder{encoderSettings, [&od4](opendlv::video::EncoderStatus &status, uint32_t senderStamp){
+                od4.send(status, cluon::time::now(), senderStamp);
+            }};
 
-            if (END_USAGE == 0) {
-              parameters.rc_end_usage = VPX_CBR;
-            } else {
-              parameters.rc_end_usage = VPX_VBR;
+            for (auto &l : layerSpecifications) {
+                Source &source{*sources[l.source]};
+                const bool SCALED{(l.width != source.width) || (l.height != source.height)};
+                std::unique_ptr<Layer> layer{new Layer(l.width, l.height, l.bitrate, l.vp8, l.senderStamp, l.spatialLayers, l.temporalLayers, SCALED, ENCODED_FRAME_POOL_SIZE, MTU)};
+                layer->source = l.source;
+                layer->filter = source.transform.filter();
+                source.numberOfLayers++;
+                if (SCALED && !layer->scaledFrame.valid()) {
+                    std::cerr << "[opendlv-video-vpx-encoder]: Failed to allocate frame for " << l.width << "x" << l.height << "." << std::endl;
+                    return retCode;
+                }
+                if (!layerEncoder.open(*layer)) {
+                    return retCode;
+                }
+                layers.push_back(std::move(layer));
             }
 
-            parameters.g_profile = PROFILE;
-            // A value > 0 allows the encoder to consume more frames before emitting compressed frames.
-            parameters.g_lag_in_frames = LAG_IN_FRAMES; 
-
-            parameters.rc_dropframe_thresh = DROP_FRAME;
-            if (RESIZE_ALLOWED == 0) {
-                parameters.rc_resize_allowed = false; 
-            } else {
-                parameters.rc_resize_allowed = true; 
+            uint32_t maxFrameSize{0};
+            for (auto &layer : layers) {
+                maxFrameSize = std::max(maxFrameSize, static_cast<uint32_t>(layer->encodedFrames[0].data.size()));
             }
-            parameters.rc_resize_up_thresh = RESIZE_UP;
-            parameters.rc_resize_down_thresh = RESIZE_DOWN;
-            // Testing every q below rc_max_quantizer.
-            parameters.rc_min_quantizer = MIN_Q;
-            parameters.rc_undershoot_pct = UNDERSHOOT_PCT;
-            parameters.rc_overshoot_pct = OVERSHOOT_PCT;
 
-            parameters.rc_buf_sz = BUFFER_SIZE;
-            parameters.rc_buf_initial_sz = BUFFER_INIT_SIZE;
-            parameters.rc_buf_optimal_sz = BUFFER_OPTIMAL_SIZE;
-
-            if (KF_MODE == 1) {
-              parameters.kf_mode = vpx_kf_mode::VPX_KF_DISABLED;
-            } else {
-              parameters.kf_mode = vpx_kf_mode::VPX_KF_AUTO;
+            // Consumers on the same host read the frames in place from the ring; a slot holds
+            // the largest encoded frame of any layer.
+            std::unique_ptr<EncodedFrameRing> ring;
+            if (!RING.empty()) {
+                ring.reset(new EncodedFrameRing{RING, RING_SLOTS, maxFrameSize});
+                if (!ring->valid()) {
+                    std::cerr << "[opendlv-video-vpx-encoder]: Failed to create ring of " << RING_SLOTS << " frames in shared memory '" << RING << "'." << std::endl;
+                    return retCode;
+                }
+                std::clog << "[opendlv-video-vpx-encoder]: Writing encoded frames into ring of " << RING_SLOTS << " frames in shared memory '" << RING << "'." << std::endl;
             }
 
-            // kf_min_dist has two modes, either 0 or == to kf_max_dist
-            if (KF_MIN_DIST == 0) {
-                parameters.kf_min_dist = KF_MIN_DIST;
-            } else {
-                parameters.kf_min_dist = KF_MAX_DIST;
+            // Archives with one file per layer; the files of several layers are told apart by senderStamp.
+            auto filenameOf = [&layers](const std::string &filename, const Layer &layer) {
+                const std::size_t DOT{filename.rfind('.')};
+                const std::size_t SLASH{filename.rfind('/')};
+                const std::size_t POSITION{((std::string::npos != DOT) && ((std::string::npos == SLASH) || (SLASH < DOT))) ? DOT : filename.size()};
+                return (1 < layers.size()) ? filename.substr(0, POSITION) + "-" + std::to_string(layer.senderStamp) + filename.substr(POSITION) : filename;
+            };
+            for (auto &layer : layers) {
+                const uint32_t MAX_FRAME_SIZE{static_cast<uint32_t>(layer->encodedFrames[0].data.size())};
+                if (!IVF.empty()) {
+                    layer->ivf.reset(new IvfWriter{filenameOf(IVF, *layer), layer->vp8, layer->width, layer->height, MAX_FRAME_SIZE});
+                    if (!layer->ivf->valid()) {
+                        std::cerr << "[opendlv-video-vpx-encoder]: Failed to open '" << filenameOf(IVF, *layer) << "'." << std::endl;
+                        return retCode;
+                    }
+                }
+                if (!WEBM.empty()) {
+                    layer->webm.reset(new WebmWriter{filenameOf(WEBM, *layer), layer->vp8, layer->width, layer->height, MAX_FRAME_SIZE});
+                    if (!layer->webm->valid()) {
+                        std::cerr << "[opendlv-video-vpx-encoder]: Failed to open '" << filenameOf(WEBM, *layer) << "'." << std::endl;
+                        return retCode;
+                    }
+                }
             }
-            parameters.kf_max_dist = KF_MAX_DIST;
 
-            vpx_codec_ctx_t codec;
-            memset(&codec, 0, sizeof(codec));
-            result = vpx_codec_enc_init(&codec, encoderAlgorithm, &parameters, 0);
-            if (result) {
-                std::cerr << "[opendlv-video-vpx-encoder]: Failed to initialize encoder: " << vpx_codec_err_to_string(result) << std::endl;
-                return retCode;
-            }
-            else {
-                std::clog << "[opendlv-video-vpx-encoder]: Using " << vpx_codec_iface_name(encoderAlgorithm) << std::endl;
+            // The bucket of a pacer holds the next datagram of the layer's outputs.
+            if (0 < PACING) {
+                for (auto &layer : layers) {
+                    layer->pacer.reset(new Pacer{PACING});
+                }
             }
-            vpx_codec_control(&codec, VP8E_SET_CPUUSED, CPUUSED);
-
-            // Allocate image buffer to hold VP9 frame as output.
-            std::vector<char> vpxBuffer;
-            vpxBuffer.resize(WIDTH * HEIGHT, '0'); // In practice, this is smaller than WIDTH * HEIGHT
 
-            uint32_t frameCounter{0};
-
-            cluon::data::TimeStamp before, after, sampleTimeStamp;
-
-            // Interface to a running OpenDaVINCI session (ignoring any incoming Envelopes).
-            cluon::OD4Session od4{static_cast<uint16_t>(std::stoi(commandlineArguments["cid"]))};
-
-            while ( (sharedMemory && sharedMemory->valid()) && od4.isRunning() ) {
-                // Wait for incoming frame.
-                sharedMemory->wait();
+            // Every layer is sent as RTP stream of its own to the next even port; receivers
+            // need the SDP description as RTP does not describe the stream in band.
+            if (!RTP.empty()) {
+                const std::size_t COLON{RTP.rfind(':')};
+                if (std::string::npos == COLON) {
+                    std::cerr << "[opendlv-video-vpx-encoder]: Invalid RTP endpoint '" << RTP << "'; expected <address>:<port>." << std::endl;
+                    return retCode;
+                }
+                const std::string RTP_ADDRESS{RTP.substr(0, COLON)};
+                const uint16_t RTP_PORT{static_cast<uint16_t>(std::stoi(RTP.substr(COLON + 1)))};
+                std::stringstream sdp;
+                sdp << "v=0\no=- 0 0 IN IP4 127.0.0.1\ns=opendlv-video-vpx-encoder\nc=IN IP4 " << RTP_ADDRESS << "\nt=0 0\n";
+                for (uint32_t i{0}; i < layers.size(); i++) {
+                    Layer &layer{*layers[i]};
+                    std::vector<std::pair<uint32_t, uint32_t> > spatialSizes;
+                    for (uint32_t j{0}; j < layer.spatialLayers; j++) {
+                        spatialSizes.push_back(std::make_pair(layer.spatialWidth(j), layer.spatialHeight(j)));
+                    }
+                    const uint16_t PORT{static_cast<uint16_t>(RTP_PORT + 2 * i)};
+                    layer.rtp.reset(new RtpSender{RTP_ADDRESS, PORT, layer.vp8, RTP_PAYLOAD_TYPE, RTP_MTU, spatialSizes, layer.temporalLayers});
+                    if (!layer.rtp->valid()) {
+                        std::cerr << "[opendlv-video-vpx-encoder]: Failed to create socket to send RTP to " << RTP_ADDRESS << ":" << PORT << "." << std::endl;
+                        return retCode;
+                    }
+                    sdp << "m=video " << PORT << " RTP/AVP " << static_cast<uint32_t>(RTP_PAYLOAD_TYPE) << "\n"
+                        << "a=rtpmap:" << static_cast<uint32_t>(RTP_PAYLOAD_TYPE) << (layer.vp8 ? " VP8" : " VP9") << "/90000\n"
+                        << "a=ssrc:" << layer.rtp->ssrc() << " cname:senderStamp-" << layer.senderStamp << "\n";
+                }
+                std::clog << "[opendlv-video-vpx-encoder]: Sending RTP to " << RTP << "; SDP:" << std::endl << sdp.str();
+            }
 
-                sampleTimeStamp = cluon::time::now();
+            // The Envelopes are recorded as they are published, i.e., unfragmented and in the
+            // format read by cluon::Player; a buffer holds at least the largest Envelope.
+            std::unique_ptr<FileWriter> recorder;
+            if (!REC.empty()) {
+                const uint32_t REC_BUFFER_SIZE{std::max(4u * 1024u * 1024u, maxFrameSize + 4096u)};
+                const uint32_t REC_BUFFERS{8};
+                recorder.reset(new FileWriter{REC, REC_BUFFER_SIZE, REC_BUFFERS, REC_MAX_SIZE, REC_MAX_DURATION});
+                if (!recorder->valid()) {
+                    std::cerr << "[opendlv-video-vpx-encoder]: Failed to open '" << REC << "' for recording." << std::endl;
+                    return retCode;
+                }
+                std::clog << "[opendlv-video-vpx-encoder]: Recording to '" << REC << "'." << std::endl;
+            }
 
-                sharedMemory->lock();
-                {
-                    // Read notification timestamp.
-                    auto r = sharedMemory->getTimeStamp();
-                    sampleTimeStamp = (r.first ? r.second : sampleTimeStamp);
+            // EncoderControl messages are handed to the layer with the same senderStamp and applied
+            // by its encoding thread. Controls that do not fit into the layer's queue are rejected
+            // right away.
+            od4.dataTrigger(opendlv::video::EncoderControl::ID(), [&layers, &od4, VERBOSE](cluon::data::Envelope &&env){
+                const uint32_t SENDER_STAMP{env.senderStamp()};
+                auto control = cluon::extractMessage<opendlv::video::EncoderControl>(std::move(env));
+                for (auto &layer : layers) {
+                    if ((SENDER_STAMP == layer->senderStamp) && !layer->controls.push(control)) {
+                        opendlv::video::EncoderStatus status;
+                        status.requestIdentifier(control.requestIdentifier())
+                              .accepted(false);
+                        od4.send(status, cluon::time::now(), layer->senderStamp);
+                        if (VERBOSE) {
+                            std::clog << "[opendlv-video-vpx-encoder]: Rejected control " << control.requestIdentifier() << " to senderStamp " << layer->senderStamp << " as too many controls are pending." << std::endl;
+                        }
+                    }
                 }
-                {
-                    if (VERBOSE) {
-                        before = cluon::time::now();
+            });
+
+            if (KEYFRAME_REQUESTS) {
+                od4.dataTrigger(opendlv::video::KeyFrameRequest::ID(), [&](cluon::data::Envelope &&env){
+                    const uint32_t SENDER_STAMP{env.senderStamp()};
+                    auto request = cluon::extractMessage<opendlv::video::KeyFrameRequest>(std::move(env));
+                    const int64_t NOW{cluon::time::toMicroseconds(cluon::time::now())};
+                    // Subscribers whose last accepted request is older than the interval would be
+                    // accepted anyway; forgetting them keeps the map from growing with every subscriber.
+                    for (auto it = lastKeyFrameRequests.begin(); it != lastKeyFrameRequests.end();) {
+                        it = (KEYFRAME_REQUEST_INTERVAL <= (NOW - it->second)) ? lastKeyFrameRequests.erase(it) : std::next(it);
                     }
-                    int flags{ (0 == (frameCounter%GOP)) ? VPX_EFLAG_FORCE_KF : 0 };
-                    result = vpx_codec_encode(&codec, &yuvFrame, frameCounter, 1, flags, VPX_DL_REALTIME);
-                    if (result) {
-                        std::cerr << "[opendlv-video-vpx-encoder]: Failed to encode frame: " << vpx_codec_err_to_string(result) << std::endl;
+                    auto entry = lastKeyFrameRequests.emplace(std::make_pair(SENDER_STAMP, request.subscriberIdentifier()), NOW);
+                    const bool ACCEPTED{entry.second || (KEYFRAME_REQUEST_INTERVAL <= (NOW - entry.first->second))};
+                    if (ACCEPTED) {
+                        entry.first->second = NOW;
+                        for (auto &layer : layers) {
+                            if (SENDER_STAMP == layer->senderStamp) {
+                                layer->keyFrameRequested.store(true);
+                            }
+                        }
                     }
                     if (VERBOSE) {
-                        after = cluon::time::now();
+                        std::clog << "[opendlv-video-vpx-encoder]: Keyframe request from subscriber " << request.subscriberIdentifier() << " for senderStamp " << SENDER_STAMP << (ACCEPTED ? " accepted." : " ignored.") << std::endl;
                     }
-                }
-                sharedMemory->unlock();
-
-                if (!result) {
-                    vpx_codec_iter_t it{nullptr};
-                    const vpx_codec_cx_pkt_t *packet{nullptr};
-
-                    int totalSize{0};
-                    while ((packet = vpx_codec_get_cx_data(&codec, &it))) {
-                        switch (packet->kind) {
-                            case VPX_CODEC_CX_FRAME_PKT:
-                                memcpy(&vpxBuffer[totalSize], packet->data.frame.buf, packet->data.frame.sz);
-                                totalSize += packet->data.frame.sz;
-                            break;
-                        default:
-                            break;
-                        }
+                });
+            }
+
+            // Sources that become stale or deliver frames again are reported to the OD4Session
+            // with the senderStamps of their layers.
+            FrameCapture::Settings captureSettings;
+            captureSettings.copy = COPY;
+            captureSettings.fps = FPS;
+            captureSettings.timedWait = TIMED_WAIT;
+            captureSettings.staleTimeout = STALE_TIMEOUT;
+            captureSettings.verbose = VERBOSE;
+            FrameCapture frameCapture{captureSettings, sources, [&od4, &layers](opendlv::video::SourceStatus &status, uint32_t index){
+                for (auto &layer : layers) {
+                    if (index == layer->source) {
+                        od4.send(status, cluon::time::now(), layer->senderStamp);
                     }
+                }
+            }};
 
-                    if ( (0 < totalSize) && (VP8 || VP9) ) {
-                        opendlv::proxy::ImageReading ir;
-                        ir.fourcc((VP8 ? "VP80" : "VP90")).width(WIDTH).height(HEIGHT).data(std::string(&vpxBuffer[0], totalSize));
-                        od4.send(ir, sampleTimeStamp, ID);
+            Publisher::Settings publisherSettings;
+            publisherSettings.fec = FEC;
+            publisherSettings.fecKeyFrame = FEC_KEYFRAME;
+            publisherSettings.reportUnchanged = (0 <= STATIC_THRESHOLD);
+            publisherSettings.verbose = VERBOSE;
+            Publisher publisher{publisherSettings, sender, layers, ring.get(), recorder.get()};
 
-                        if (VERBOSE) {
-                            std::clog << "[opendlv-video-vpx-encoder]: Frame size = " << totalSize << " bytes; sample time = " << cluon::time::toMicroseconds(sampleTimeStamp) << " microseconds; encoding took " << cluon::time::deltaInMicroseconds(after, before) << " microseconds." << std::endl;
-                        }
-                        frameCounter++;
+            // After a stop signal, the threads of this process waiting for frames are interrupted;
+            // notifying the shared memory areas would also wake the other processes reading them.
+            std::atomic<bool> stopped{false};
+            std::atomic<bool> finished{false};
+            std::thread signalWaiter([&]() {
+                int32_t signalNumber{0};
+                ::sigwait(&stopSignals, &signalNumber);
+                if (!finished.load()) {
+                    stopped.store(true);
+                    for (auto &source : sources) {
+                        source->waiter->interrupt();
                     }
                 }
-            }
+            });
+
+            Pipeline::Settings pipelineSettings;
+            pipelineSettings.threaded = THREADED;
+            pipelineSettings.copy = COPY;
+            pipelineSettings.numberOfWorkers = (0 < WORKERS) ? WORKERS : std::min(static_cast<uint32_t>(layers.size()), CORES);
+            pipelineSettings.verbose = VERBOSE;
+            Pipeline pipeline{pipelineSettings, sources, layers, frameCapture, layerEncoder, publisher};
+            pipeline.run([&od4, &stopped](){ return od4.isRunning() && !stopped.load(); });
 
-            vpx_codec_destroy(&codec);
+            // Ends the thread waiting for a stop signal if none was received.
+            finished.store(true);
+            ::pthread_kill(signalWaiter.native_handle(), SIGTERM);
+            signalWaiter.join();
+            if (stopped.load()) {
+                std::clog << "[opendlv-video-vpx-encoder]: Stopped by signal; closing outputs." << std::endl;
+            }
 
             retCode = 0;
         }
-        else {
-            std::cerr << "[opendlv-video-vpx-encoder]: Failed to attach to shared memory '" << NAME << "'." << std::endl;
-        }
     }
     return retCode;
 }
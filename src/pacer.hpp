@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PACER_HPP
+#define PACER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+/**
+ * This class spreads the datagrams of a frame over a fraction of the frame
+ * interval with a token bucket so that large frames do not leave the host in
+ * one burst, which overflows the small buffers of switches and Wi-Fi links.
+ * The bucket is refilled at the rate that sends a frame of average size (as
+ * given by the target bitrate) within the fraction of the frame interval;
+ * larger frames, e.g., keyframes, are sent faster so that every frame is sent
+ * within this fraction. The bucket holds the next datagram, so that datagrams
+ * are evenly spaced even after an idle period and whatever the size of the
+ * largest datagram of the outputs; only to make up for oversleeping, two
+ * datagrams may follow each other directly.
+ */
+class Pacer {
+   private:
+    Pacer(const Pacer &) = delete;
+    Pacer(Pacer &&)      = delete;
+    Pacer &operator=(const Pacer &) = delete;
+    Pacer &operator=(Pacer &&) = delete;
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param fraction Fraction of the frame interval to send a frame in (0 < fraction <= 1).
+     */
+    explicit Pacer(double fraction) noexcept
+        : m_fraction{std::min(std::max(fraction, 0.01), 1.0)} {}
+
+    /**
+     * This method sets the rate for the next frame.
+     *
+     * @param size Size of the frame in bytes.
+     * @param bitrate Target bitrate of the stream in bits per second.
+     * @param frameInterval Frame interval in microseconds.
+     */
+    void frame(uint32_t size, uint32_t bitrate, int64_t frameInterval) noexcept {
+        const double WINDOW{m_fraction * static_cast<double>(std::max<int64_t>(frameInterval, 1))};
+        const double AVERAGE_RATE{static_cast<double>(bitrate) / 8.0 / 1000000.0 / m_fraction};
+        m_rate = std::max(AVERAGE_RATE, static_cast<double>(size) / WINDOW);
+        m_maxBurst = 0;
+        m_burstSize = 0;
+        m_gaps = 0;
+        m_sumOfGaps = 0;
+        m_maxGap = 0;
+        m_firstOfFrame = true;
+    }
+
+    /**
+     * This method waits until the given number of bytes may be sent.
+     *
+     * @param bytes Size of the next datagram.
+     */
+    void pace(uint32_t bytes) noexcept {
+        auto now{std::chrono::steady_clock::now()};
+        refill(now, bytes);
+        const double MISSING{static_cast<double>(bytes) - m_tokens};
+        if ((0 < MISSING) && (0 < m_rate)) {
+            // Sleeping takes longer than asked for; the excess is credited up to another
+            // datagram of this size so that the rate is kept.
+            std::this_thread::sleep_for(std::chrono::microseconds(static_cast<int64_t>(MISSING / m_rate)));
+            now = std::chrono::steady_clock::now();
+            refill(now, 2 * bytes);
+            m_burstSize = 0;
+        }
+        m_tokens = std::max(0.0, m_tokens - bytes);
+
+        // Statistics: bytes sent back-to-back and gaps between the datagrams of the frame.
+        m_burstSize += bytes;
+        m_maxBurst = std::max(m_maxBurst, m_burstSize);
+        if (!m_firstOfFrame) {
+            const int64_t GAP{std::chrono::duration_cast<std::chrono::microseconds>(now - m_last).count()};
+            m_gaps++;
+            m_sumOfGaps += GAP;
+            m_maxGap = std::max(m_maxGap, GAP);
+        }
+        m_firstOfFrame = false;
+        m_last = now;
+    }
+
+    /**
+     * @return Largest number of bytes of the last frame sent without waiting.
+     */
+    uint32_t maxBurst() const noexcept {
+        return m_maxBurst;
+    }
+
+    /**
+     * @return Mean gap between the datagrams of the last frame in microseconds.
+     */
+    int64_t meanGap() const noexcept {
+        return (0 < m_gaps) ? m_sumOfGaps / m_gaps : 0;
+    }
+
+    /**
+     * @return Largest gap between the datagrams of the last frame in microseconds.
+     */
+    int64_t maxGap() const noexcept {
+        return m_maxGap;
+    }
+
+   private:
+    void refill(const std::chrono::steady_clock::time_point &now, uint32_t capacity) noexcept {
+        const double ELAPSED{static_cast<double>(std::chrono::duration_cast<std::chrono::microseconds>(now - m_lastRefill).count())};
+        m_tokens = std::min(static_cast<double>(capacity), m_tokens + ELAPSED * m_rate);
+        m_lastRefill = now;
+    }
+
+   private:
+    const double m_fraction;
+    double m_rate{0};  // Bytes per microsecond.
+    double m_tokens{0};
+    std::chrono::steady_clock::time_point m_lastRefill{std::chrono::steady_clock::now()};
+    std::chrono::steady_clock::time_point m_last{};
+
+    bool m_firstOfFrame{true};
+    uint32_t m_burstSize{0};
+    uint32_t m_maxBurst{0};
+    int64_t m_gaps{0};
+    int64_t m_sumOfGaps{0};
+    int64_t m_maxGap{0};
+};
+
+#endif
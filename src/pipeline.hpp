@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include "cluon-complete.hpp"
+#include "encoded-frame.hpp"
+#include "frame-capture.hpp"
+#include "frame-pool.hpp"
+#include "layer.hpp"
+#include "layer-encoder.hpp"
+#include "publisher.hpp"
+#include "source.hpp"
+#include "wakeup.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/**
+ * This class runs the capturing, encoding, and publishing of the frames until
+ * it is told to stop. Sequentially, one layer is encoded from one shared
+ * memory area in the calling thread. Otherwise, every shared memory area has
+ * a capture thread that hands its frames to its layers, a pool of workers
+ * encodes the frames of all layers, and one thread publishes them; the frames
+ * are handed between the threads through the lock-free queues of the layers,
+ * and idle threads sleep until they are signalled.
+ */
+class Pipeline {
+   private:
+    Pipeline(const Pipeline &) = delete;
+    Pipeline(Pipeline &&)      = delete;
+    Pipeline &operator=(const Pipeline &) = delete;
+    Pipeline &operator=(Pipeline &&) = delete;
+
+   public:
+    /**
+     * Settings as given on the command line.
+     */
+    struct Settings {
+        bool threaded{false};
+        bool copy{false};  // Frames are copied out of the shared memory before encoding.
+        uint32_t numberOfWorkers{1};
+        bool verbose{false};
+    };
+
+    /**
+     * Constructor.
+     *
+     * @param settings Settings of the pipeline.
+     * @param sources Shared memory areas to capture from.
+     * @param layers Layers to encode.
+     * @param capture Capture of the frames from the shared memory areas.
+     * @param encoder Encoder of the layers.
+     * @param publisher Publisher of the encoded frames.
+     */
+    Pipeline(const Settings &settings, std::vector<std::unique_ptr<Source> > &sources, std::vector<std::unique_ptr<Layer> > &layers, FrameCapture &capture, const LayerEncoder &encoder, Publisher &publisher) noexcept
+        : m_settings{settings}
+        , m_sources{sources}
+        , m_layers{layers}
+        , m_capture{capture}
+        , m_encoder{encoder}
+        , m_publisher{publisher} {}
+
+    /**
+     * This method runs the pipeline until proceed returns false or a shared
+     * memory area becomes invalid. To stop while waiting for frames, the
+     * caller interrupts the FrameWaiters of the shared memory areas.
+     *
+     * @param proceed Returns false to stop.
+     */
+    void run(const std::function<bool()> &proceed) noexcept {
+        if (m_settings.threaded) {
+            runThreaded(proceed);
+        }
+        else {
+            runSequential(proceed);
+        }
+    }
+
+   private:
+    void runSequential(const std::function<bool()> &proceed) noexcept {
+        Source &source{*m_sources[0]};
+        cluon::SharedMemory *sharedMemory{source.sharedMemory.get()};
+        Layer &layer{*m_layers[0]};
+        CapturedFrame c;
+        EncodedFrame &out{layer.encodedFrames[0]};
+        while ( (sharedMemory && sharedMemory->valid()) && proceed() ) {
+            // Wait for incoming frame.
+            if (!m_capture.awaitFrame(0)) {
+                m_publisher.flushOld();
+                continue;
+            }
+            if (!m_capture.capture(source, c)) {
+                continue;
+            }
+            const bool ENCODED{m_encoder.encode(layer, (m_settings.copy ? source.framePool.frame(c.index) : &source.yuvFrame), c.sampleTimeStamp, c.unchanged, out, false)};
+            if (!m_settings.copy) {
+                sharedMemory->unlock();
+                if (m_settings.verbose) {
+                    c.unlocked = cluon::time::now();
+                }
+            }
+
+            if (ENCODED) {
+                out.sampleTimeStamp = c.sampleTimeStamp;
+                out.lockDuration = cluon::time::deltaInMicroseconds(c.unlocked, c.locked);
+                m_publisher.publish(layer, out);
+            }
+        }
+    }
+
+    void runThreaded(const std::function<bool()> &proceed) noexcept {
+        const uint32_t NUMBER_OF_SOURCES{static_cast<uint32_t>(m_sources.size())};
+        const uint32_t NUMBER_OF_LAYERS{static_cast<uint32_t>(m_layers.size())};
+        // Idle threads sleep until signalled but look at least this often whether to stop.
+        const std::chrono::microseconds IDLE_TIMEOUT{100000};
+        std::atomic<bool> running{true};
+        Wakeup workerWakeup;     // Signalled after pushing into any capturedFrames or freeEncodedFrames.
+        Wakeup publisherWakeup;  // Signalled after pushing into any encodedFrameQueue.
+        std::clog << "[opendlv-video-vpx-encoder]: Encoding " << NUMBER_OF_LAYERS << " layer(s) from " << NUMBER_OF_SOURCES << " shared memory area(s) with " << m_settings.numberOfWorkers << " worker(s)" << std::endl;
+
+        std::vector<std::thread> threads;
+        for (uint32_t i{0}; i < NUMBER_OF_SOURCES; i++) {
+            threads.emplace_back([&, i]() {
+                Source &source{*m_sources[i]};
+                CapturedFrame c;
+                while (running.load() && proceed() && source.sharedMemory->valid()) {
+                    // Wait for incoming frame.
+                    if (!m_capture.awaitFrame(i)) {
+                        continue;
+                    }
+
+                    // Never block the producer: skip this frame when an encoder is behind.
+                    if (!source.framePool.acquire(c.index, source.numberOfLayers)) {
+                        if (m_settings.verbose) {
+                            std::clog << "[opendlv-video-vpx-encoder]: Encoder busy, skipping frame from '" << source.sharedMemory->name() << "'." << std::endl;
+                        }
+                        continue;
+                    }
+                    if (!m_capture.capture(source, c)) {
+                        source.framePool.release(c.index, source.numberOfLayers);
+                        continue;
+                    }
+                    for (auto &layer : m_layers) {
+                        if (i == layer->source) {
+                            layer->capturedFrames.push(c);
+                        }
+                    }
+                    workerWakeup.notify();
+                }
+                running.store(false);
+            });
+        }
+
+        // A worker takes any layer with a captured frame that no other worker is encoding;
+        // the workers start at different layers and continue after the last encoded one so
+        // that every layer gets its turn. A worker that finds nothing sleeps until signalled;
+        // a frame of a layer that was busy is found by its worker looking again after encoding.
+        for (uint32_t w{0}; w < m_settings.numberOfWorkers; w++) {
+            threads.emplace_back([&, w]() {
+                uint32_t next{w % NUMBER_OF_LAYERS};
+                CapturedFrame c;
+                while (running.load()) {
+                    const uint64_t GENERATION{workerWakeup.generation()};
+                    bool encoded{false};
+                    for (uint32_t k{0}; (k < NUMBER_OF_LAYERS) && !encoded; k++) {
+                        Layer &layer{*m_layers[(next + k) % NUMBER_OF_LAYERS]};
+                        if (layer.busy.exchange(true, std::memory_order_acquire)) {
+                            continue;
+                        }
+                        if (!layer.hasEncodedFrame) {
+                            layer.hasEncodedFrame = layer.freeEncodedFrames.pop(layer.encodedFrameIndex);
+                        }
+                        if (layer.hasEncodedFrame && layer.capturedFrames.pop(c)) {
+                            FramePool &framePool{m_sources[layer.source]->framePool};
+                            EncodedFrame &out{layer.encodedFrames[layer.encodedFrameIndex]};
+                            if (m_encoder.encode(layer, framePool.frame(c.index), c.sampleTimeStamp, c.unchanged, out, true)) {
+                                out.sampleTimeStamp = c.sampleTimeStamp;
+                                out.lockDuration = cluon::time::deltaInMicroseconds(c.unlocked, c.locked);
+                                layer.encodedFrameQueue.push(layer.encodedFrameIndex);
+                                layer.hasEncodedFrame = false;
+                                publisherWakeup.notify();
+                            }
+                            framePool.release(c.index);
+                            next = (next + k + 1) % NUMBER_OF_LAYERS;
+                            encoded = true;
+                        }
+                        layer.busy.store(false, std::memory_order_release);
+                    }
+                    if (!encoded) {
+                        workerWakeup.wait(GENERATION, IDLE_TIMEOUT);
+                    }
+                }
+            });
+        }
+
+        threads.emplace_back([&]() {
+            uint32_t index{0};
+            while (running.load()) {
+                const uint64_t GENERATION{publisherWakeup.generation()};
+                bool published{false};
+                for (auto &layer : m_layers) {
+                    if (layer->encodedFrameQueue.pop(index)) {
+                        m_publisher.publish(*layer, layer->encodedFrames[index]);
+                        layer->freeEncodedFrames.push(index);
+                        published = true;
+                    }
+                }
+                if (published) {
+                    workerWakeup.notify();
+                }
+                else {
+                    m_publisher.flushOld();
+                    publisherWakeup.wait(GENERATION, IDLE_TIMEOUT);
+                }
+            }
+        });
+
+        while (running.load() && proceed()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        running.store(false);
+        for (auto &source : m_sources) {
+            source->waiter->interrupt();
+        }
+        workerWakeup.notify();
+        publisherWakeup.notify();
+
+        for (auto &t : threads) {
+            t.join();
+        }
+    }
+
+   private:
+    const Settings m_settings;
+    std::vector<std::unique_ptr<Source> > &m_sources;
+    std::vector<std::unique_ptr<Layer> > &m_layers;
+    FrameCapture &m_capture;
+    const LayerEncoder &m_encoder;
+    Publisher &m_publisher;
+};
+
+#endif
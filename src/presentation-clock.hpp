@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PRESENTATION_CLOCK_HPP
+#define PRESENTATION_CLOCK_HPP
+
+#include "cluon-complete.hpp"
+
+#include <cstdint>
+
+/**
+ * This class derives presentation time stamps and frame durations in
+ * microseconds from the sample time stamps of the captured frames so that
+ * the rate control works at any and at varying frame rates. The frame
+ * interval is smoothed with a weight of 1/16 as used for RTP's interarrival
+ * jitter; time stamps that deviate less than half an interval from the
+ * expected one are pulled towards it to remove jitter while gaps from
+ * skipped frames are kept.
+ */
+class PresentationClock {
+   private:
+    PresentationClock(const PresentationClock &) = delete;
+    PresentationClock(PresentationClock &&)      = delete;
+    PresentationClock &operator=(const PresentationClock &) = delete;
+    PresentationClock &operator=(PresentationClock &&) = delete;
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param initialInterval Frame interval in microseconds until it is measured.
+     */
+    explicit PresentationClock(int64_t initialInterval) noexcept
+        : m_interval{initialInterval} {}
+
+    /**
+     * This method computes the presentation time stamp for the next frame.
+     *
+     * @param sampleTimeStamp Time point when the frame was captured.
+     * @return Presentation time stamp in microseconds since the first frame.
+     */
+    int64_t update(const cluon::data::TimeStamp &sampleTimeStamp) noexcept {
+        const int64_t T{cluon::time::toMicroseconds(sampleTimeStamp)};
+        if (!m_initialized) {
+            m_initialized = true;
+            m_first = T;
+            m_last = T;
+            m_pts = 0;
+            return m_pts;
+        }
+
+        const int64_t DELTA{T - m_last};
+        m_last = T;
+        if ((0 < DELTA) && (DELTA < MAX_INTERVAL)) {
+            m_interval = m_measured ? m_interval + (DELTA - m_interval) / 16 : DELTA;
+            m_measured = true;
+        }
+
+        const int64_t EXPECTED{m_pts + m_interval};
+        const int64_t MEASURED{T - m_first};
+        int64_t pts{MEASURED};
+        if (((EXPECTED - m_interval / 2) < MEASURED) && (MEASURED < (EXPECTED + m_interval / 2))) {
+            pts = EXPECTED + (MEASURED - EXPECTED) / 16;
+        }
+        m_pts = (m_pts < pts) ? pts : m_pts + 1;
+        return m_pts;
+    }
+
+    /**
+     * @return Smoothed frame interval in microseconds.
+     */
+    int64_t interval() const noexcept {
+        return m_interval;
+    }
+
+   private:
+    static constexpr int64_t MAX_INTERVAL{1000000};
+
+    bool m_initialized{false};
+    bool m_measured{false};
+    int64_t m_interval;
+    int64_t m_first{0};
+    int64_t m_last{0};
+    int64_t m_pts{0};
+};
+
+#endif
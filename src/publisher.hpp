@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PUBLISHER_HPP
+#define PUBLISHER_HPP
+
+#include "cluon-complete.hpp"
+#include "opendlv-standard-message-set.hpp"
+#include "opendlv-video-message-set.hpp"
+#include "encoded-frame.hpp"
+#include "encoded-frame-ring.hpp"
+#include "envelope-sender.hpp"
+#include "file-writer.hpp"
+#include "layer.hpp"
+#include "rtp-sender.hpp"
+#include "vpx-encoder.hpp"
+
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+/**
+ * This class hands the encoded frames of all layers to their outputs: the
+ * OD4Session (as fragments if needed), the ring, the recording, the archives,
+ * and the RTP streams. Superframes from an SVC encoder are split into their
+ * spatial layers, which are sent as separate LayeredImageReadings so that
+ * receivers and relays can drop the upper ones; as libvpx drops spatial
+ * layers only from the top, the frames in a superframe belong to the lowest
+ * layers. With temporal layers, every LayeredImageReading carries the
+ * temporal layer of its frame. All frames are published from one thread.
+ */
+class Publisher {
+   private:
+    Publisher(const Publisher &) = delete;
+    Publisher(Publisher &&)      = delete;
+    Publisher &operator=(const Publisher &) = delete;
+    Publisher &operator=(Publisher &&) = delete;
+
+   public:
+    /**
+     * Settings of all layers as given on the command line.
+     */
+    struct Settings {
+        uint32_t fec{0};              // Group size of the forward error correction; 0 = off.
+        uint32_t fecKeyFrame{0};      // Group size for keyframes.
+        bool reportUnchanged{false};  // Report the skipped and encoded unchanged frames with --verbose.
+        bool verbose{false};
+    };
+
+    /**
+     * Constructor.
+     *
+     * @param settings Settings of all layers.
+     * @param sender Socket to send the Envelopes to the OD4Session from.
+     * @param layers Layers to publish the frames of.
+     * @param ring Ring for consumers on the same host or nullptr.
+     * @param recorder Recording of the published Envelopes or nullptr.
+     */
+    Publisher(const Settings &settings, EnvelopeSender &sender, std::vector<std::unique_ptr<Layer> > &layers, EncodedFrameRing *ring, FileWriter *recorder) noexcept
+        : m_settings{settings}
+        , m_sender{sender}
+        , m_layers{layers}
+        , m_ring{ring}
+        , m_recorder{recorder} {
+        // The smaller group needs more parity fragments.
+        uint32_t groupSize{(1 < settings.fec) ? settings.fec : 0};
+        if ((1 < settings.fecKeyFrame) && ((0 == groupSize) || (settings.fecKeyFrame < groupSize))) {
+            groupSize = settings.fecKeyFrame;
+        }
+        for (auto &layer : m_layers) {
+            layer->fragmenter.reserve(static_cast<uint32_t>(sizeof(layer->imageReadingFields) + layer->encodedFrames[0].data.size()), groupSize);
+        }
+    }
+
+    /**
+     * This method publishes an encoded frame.
+     *
+     * @param layer Layer of the frame.
+     * @param f Encoded frame.
+     */
+    void publish(Layer &layer, const EncodedFrame &f) noexcept {
+        const bool LAYERED{(1 < layer.spatialLayers) || (1 < layer.temporalLayers)};
+        uint32_t numberOfFrames{LAYERED ? VpxEncoder::superframe(f.payload, f.size, layer.frameSizes, layer.spatialLayers) : 0};
+        if (0 == numberOfFrames) {
+            layer.frameSizes[0] = f.size;
+            numberOfFrames = 1;
+        }
+
+        // Archives keep superframes whole and use the capture time of the frame.
+        const int64_t SAMPLE_TIME{cluon::time::toMicroseconds(f.sampleTimeStamp)};
+        if (layer.ivf) {
+            layer.ivf->write(f.payload, f.size, SAMPLE_TIME);
+        }
+        if (layer.webm) {
+            layer.webm->write(f.payload, f.size, SAMPLE_TIME, f.keyFrame);
+        }
+
+        // The pacer spreads the datagrams of all outputs of this frame.
+        const uint32_t GROUP_SIZE{f.keyFrame ? m_settings.fecKeyFrame : m_settings.fec};
+        if (layer.pacer) {
+            const uint32_t PARITY{(1 < GROUP_SIZE) ? f.size / GROUP_SIZE : 0};
+            layer.pacer->frame((layer.rtp ? 2 : 1) * f.size + PARITY, f.bitrate, f.frameInterval);
+        }
+
+        uint32_t datagrams{0};
+        uint32_t offset{0};
+        for (uint32_t i{0}; i < numberOfFrames; i++) {
+            const uint32_t SIZE{layer.frameSizes[i]};
+            // Fields of opendlv::proxy::ImageReading or opendlv::video::LayeredImageReading preceding the frame.
+            ProtoWriter fields{layer.imageReadingFields, sizeof(layer.imageReadingFields)};
+            fields.bytes(1, (layer.vp8 ? "VP80" : "VP90"), 4)
+                .varInt(2, LAYERED ? layer.spatialWidth(i) : layer.width)
+                .varInt(3, LAYERED ? layer.spatialHeight(i) : layer.height);
+            if (LAYERED) {
+                fields.varInt(5, i)
+                    .varInt(6, layer.spatialLayers)
+                    .varInt(7, f.temporalLayer)
+                    .varInt(8, layer.temporalLayers);
+            }
+            fields.bytesHeader(4, SIZE);
+            struct iovec parts[2];
+            parts[0].iov_base = layer.imageReadingFields;
+            parts[0].iov_len = fields.size();
+            parts[1].iov_base = const_cast<char*>(f.payload) + offset;
+            parts[1].iov_len = SIZE;
+            const uint32_t DATAGRAMS{layer.fragmenter.send(m_sender, (LAYERED ? opendlv::video::LayeredImageReading::ID() : opendlv::proxy::ImageReading::ID()), parts, 2, f.sampleTimeStamp, layer.senderStamp, layer.pacer.get(), GROUP_SIZE)};
+            if (0 == DATAGRAMS) {
+                std::cerr << "[opendlv-video-vpx-encoder]: Failed to send frame of " << SIZE << " bytes." << std::endl;
+            }
+            datagrams += DATAGRAMS;
+
+            if (layer.rtp) {
+                RtpSender::Frame frame;
+                frame.sampleTimeStamp = SAMPLE_TIME;
+                frame.keyFrame = f.keyFrame;
+                frame.spatialLayer = i;
+                frame.temporalLayer = f.temporalLayer;
+                frame.endOfPicture = (i + 1 == numberOfFrames);
+                layer.rtp->send(f.payload + offset, SIZE, frame, layer.pacer.get());
+            }
+
+            if (nullptr != m_recorder) {
+                const cluon::data::TimeStamp NOW{cluon::time::now()};
+                const int32_t DATA_TYPE{LAYERED ? opendlv::video::LayeredImageReading::ID() : opendlv::proxy::ImageReading::ID()};
+                if (m_recordFraming.frame(DATA_TYPE, static_cast<uint32_t>(parts[0].iov_len + SIZE), NOW, NOW, f.sampleTimeStamp, layer.senderStamp)) {
+                    struct iovec envelope[4]{m_recordFraming.prefix(), parts[0], parts[1], m_recordFraming.suffix()};
+                    m_recorder->write(envelope, 4);
+                }
+            }
+
+            if (nullptr != m_ring) {
+                RingSlot slot;
+                slot.sampleTimeStamp = SAMPLE_TIME;
+                slot.pts = f.pts;
+                slot.senderStamp = layer.senderStamp;
+                std::memcpy(slot.fourcc, (layer.vp8 ? "VP80" : "VP90"), sizeof(slot.fourcc));
+                slot.width = LAYERED ? layer.spatialWidth(i) : layer.width;
+                slot.height = LAYERED ? layer.spatialHeight(i) : layer.height;
+                slot.keyFrame = (f.keyFrame ? 1 : 0);
+                slot.spatialLayer = static_cast<uint8_t>(i);
+                slot.temporalLayer = static_cast<uint8_t>(f.temporalLayer);
+                if (!m_ring->write(slot, f.payload + offset, SIZE)) {
+                    std::cerr << "[opendlv-video-vpx-encoder]: Frame of " << SIZE << " bytes exceeds the slots of the ring." << std::endl;
+                }
+            }
+            offset += SIZE;
+        }
+
+        if (m_settings.verbose) {
+            std::clog << "[opendlv-video-vpx-encoder]: Frame size = " << f.size << " bytes; senderStamp = " << layer.senderStamp << "; ";
+            if (LAYERED) {
+                std::clog << "spatial layers = " << numberOfFrames << "; temporal layer = " << f.temporalLayer << "; ";
+            }
+            if (layer.pacer) {
+                std::clog << "paced with max. burst = " << layer.pacer->maxBurst() << " bytes, mean gap = " << layer.pacer->meanGap() << " microseconds, max. gap = " << layer.pacer->maxGap() << " microseconds; ";
+            }
+            if ((1 < m_settings.fec) || (1 < m_settings.fecKeyFrame)) {
+                std::clog << "parity fragments = " << layer.fragmenter.parityFragmentsSent() << "; ";
+            }
+            if (nullptr != m_recorder) {
+                std::clog << "recorded " << m_recorder->bytesWritten() << " bytes, dropped " << m_recorder->recordsDropped() << " Envelope(s); ";
+            }
+            if (m_settings.reportUnchanged) {
+                std::clog << "unchanged frames skipped = " << layer.unchangedFramesSkipped << ", encoded = " << layer.unchangedFramesEncoded << "; ";
+            }
+            std::clog << "peak/mean = " << layer.peakToMean(f.size) << "; sample time = " << cluon::time::toMicroseconds(f.sampleTimeStamp) << " microseconds; encoding took " << f.encodingDuration << " microseconds; shared memory was locked for " << f.lockDuration << " microseconds; sent in " << datagrams << " datagram(s), " << layer.fragmenter.fragmentsSent() << " fragments in total." << std::endl;
+        }
+    }
+
+    /**
+     * This method hands the buffered records of the recording and the archives
+     * to their writers if they are older than their flush interval, so that the
+     * records of stopped streams do not stay in the buffers. It is called from
+     * the publishing thread while there is nothing to publish.
+     */
+    void flushOld() noexcept {
+        if (nullptr != m_recorder) {
+            m_recorder->flushOld();
+        }
+        for (auto &layer : m_layers) {
+            if (layer->ivf) {
+                layer->ivf->flushOld();
+            }
+            if (layer->webm) {
+                layer->webm->flushOld();
+            }
+        }
+    }
+
+   private:
+    const Settings m_settings;
+    EnvelopeSender &m_sender;
+    std::vector<std::unique_ptr<Layer> > &m_layers;
+    EncodedFrameRing *m_ring;
+    FileWriter *m_recorder;
+    EnvelopeFraming m_recordFraming{};  // The Envelopes are recorded unfragmented in the format read by cluon::Player.
+};
+
+#endif
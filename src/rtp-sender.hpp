@@ -0,0 +1,272 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RTP_SENDER_HPP
+#define RTP_SENDER_HPP
+
+#include "pacer.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * This class sends one VP8 or VP9 stream as RTP packets to a UDP endpoint
+ * so that standard receivers (e.g., GStreamer, ffmpeg, or WebRTC gateways)
+ * can decode it. Frames are split into packets of nearly equal size that fit
+ * into the given MTU, each carrying the payload descriptor of RFC 7741 (VP8)
+ * or RFC 9628 (VP9) in non-flexible mode with a 15 bit picture ID and, with
+ * spatial or temporal layers, the layer indices. Packets are sent directly
+ * from the frame's buffer using scatter-gather I/O.
+ *
+ * The RTP time stamp is derived from the capture time of the frame at 90 kHz;
+ * the marker bit is set on the last packet of a picture, i.e., of the highest
+ * spatial layer of a VP9 superframe. Keyframes of VP9 carry the scalability
+ * structure with the size of every spatial layer.
+ */
+class RtpSender {
+   private:
+    RtpSender(const RtpSender &) = delete;
+    RtpSender(RtpSender &&)      = delete;
+    RtpSender &operator=(const RtpSender &) = delete;
+    RtpSender &operator=(RtpSender &&) = delete;
+
+   public:
+    /**
+     * Description of a frame to send.
+     */
+    struct Frame {
+        int64_t sampleTimeStamp{0};  // Capture time in microseconds.
+        bool keyFrame{false};
+        uint32_t spatialLayer{0};
+        uint32_t temporalLayer{0};
+        bool endOfPicture{true};     // Last spatial layer of the picture.
+    };
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param address Numerical IPv4 address to send to.
+     * @param port Port to send to.
+     * @param vp8 true for VP8, false for VP9.
+     * @param payloadType RTP payload type (96..127).
+     * @param mtu Maximum size of a UDP datagram's payload.
+     * @param spatialSizes Width and height of every spatial layer from the lowest one.
+     * @param temporalLayers Number of temporal layers.
+     */
+    RtpSender(const std::string &address, uint16_t port, bool vp8, uint8_t payloadType, uint32_t mtu, const std::vector<std::pair<uint32_t, uint32_t> > &spatialSizes, uint32_t temporalLayers) noexcept
+        : m_sendToAddress()
+        , m_vp8{vp8}
+        , m_payloadType{static_cast<uint8_t>(payloadType & 0x7F)}
+        , m_mtu{(mtu < MIN_MTU) ? +MIN_MTU : mtu}
+        , m_spatialSizes{spatialSizes}
+        , m_layered{(1 < spatialSizes.size()) || (1 < temporalLayers)} {
+        std::random_device rd;
+        m_ssrc = rd();
+        m_sequenceNumber = static_cast<uint16_t>(rd());
+        m_timeStampOffset = rd();
+        m_pictureId = static_cast<uint16_t>(rd() & 0x7FFF);
+
+        std::memset(&m_sendToAddress, 0, sizeof(m_sendToAddress));
+        m_sendToAddress.sin_addr.s_addr = ::inet_addr(address.c_str());
+        m_sendToAddress.sin_family      = AF_INET;
+        m_sendToAddress.sin_port        = htons(port);
+        m_socket = ::socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    }
+
+    ~RtpSender() noexcept {
+        if (!(m_socket < 0)) {
+            ::close(m_socket);
+        }
+    }
+
+    /**
+     * @return true if the socket could be created.
+     */
+    bool valid() const noexcept {
+        return !(m_socket < 0);
+    }
+
+    /**
+     * @return Synchronization source identifier of this stream.
+     */
+    uint32_t ssrc() const noexcept {
+        return m_ssrc;
+    }
+
+    /**
+     * This method sends a VP8 frame or the frame of one spatial layer of a
+     * VP9 picture; the spatial layers of a picture are sent from the lowest.
+     *
+     * @param data Frame.
+     * @param size Size of the frame.
+     * @param frame Description of the frame.
+     * @param pacer Pacer to wait for before every packet or nullptr.
+     * @return Number of packets that were sent successfully.
+     */
+    uint32_t send(const char *data, uint32_t size, const Frame &frame, Pacer *pacer = nullptr) noexcept {
+        if (m_socket < 0) {
+            return 0;
+        }
+        // All spatial layers of a picture share picture ID and TL0PICIDX.
+        if ((0 == frame.spatialLayer) && (0 == frame.temporalLayer)) {
+            m_tl0PicIdx++;
+        }
+        const uint32_t TIMESTAMP{m_timeStampOffset + static_cast<uint32_t>(static_cast<uint64_t>(frame.sampleTimeStamp) * 9 / 100)};
+
+        // Packets of nearly equal size; the first one of a VP9 keyframe also carries the scalability structure.
+        const uint32_t FIRST_HEADER{headerSize(frame, true)};
+        const uint32_t MAX_PAYLOAD{m_mtu - FIRST_HEADER};
+        const uint32_t PACKETS{(size + MAX_PAYLOAD - 1) / MAX_PAYLOAD};
+        const uint32_t PAYLOAD{(0 < PACKETS) ? (size + PACKETS - 1) / PACKETS : 0};
+
+        uint32_t packets{0};
+        for (uint32_t offset{0}; offset < size; offset += PAYLOAD) {
+            const bool FIRST{0 == offset};
+            const bool LAST{size <= offset + PAYLOAD};
+            const uint32_t LENGTH{LAST ? size - offset : PAYLOAD};
+            const uint32_t HEADER{writeHeader(frame, FIRST, LAST, TIMESTAMP)};
+
+            struct iovec parts[2];
+            parts[0].iov_base = m_header;
+            parts[0].iov_len  = HEADER;
+            parts[1].iov_base = const_cast<char*>(data) + offset;
+            parts[1].iov_len  = LENGTH;
+            struct msghdr message;
+            std::memset(&message, 0, sizeof(message));
+            message.msg_name    = &m_sendToAddress;
+            message.msg_namelen = sizeof(m_sendToAddress);
+            message.msg_iov     = parts;
+            message.msg_iovlen  = 2;
+            if (nullptr != pacer) {
+                pacer->pace(HEADER + LENGTH);
+            }
+            packets += (0 < ::sendmsg(m_socket, &message, 0)) ? 1 : 0;
+            m_sequenceNumber++;
+        }
+        m_packetsSent += packets;
+
+        if (frame.endOfPicture) {
+            m_pictureId = static_cast<uint16_t>((m_pictureId + 1) & 0x7FFF);
+        }
+        return packets;
+    }
+
+    /**
+     * @return Number of packets sent so far.
+     */
+    uint64_t packetsSent() const noexcept {
+        return m_packetsSent;
+    }
+
+   private:
+    uint32_t headerSize(const Frame &frame, bool first) const noexcept {
+        const uint32_t LAYERS{m_layered ? 2u : 0u};
+        if (m_vp8) {
+            return RTP_HEADER_SIZE + 4 + LAYERS;
+        }
+        const bool SS{first && frame.keyFrame && (0 == frame.spatialLayer)};
+        return RTP_HEADER_SIZE + 3 + LAYERS + (SS ? 1 + 4 * static_cast<uint32_t>(m_spatialSizes.size()) : 0);
+    }
+
+    // Writes RTP header and payload descriptor into m_header; returns their size.
+    uint32_t writeHeader(const Frame &frame, bool first, bool last, uint32_t timeStamp) noexcept {
+        uint8_t *h{m_header};
+        const bool MARKER{last && (m_vp8 || frame.endOfPicture)};
+        *h++ = 0x80;  // Version 2.
+        *h++ = static_cast<uint8_t>((MARKER ? 0x80 : 0x00) | m_payloadType);
+        *h++ = static_cast<uint8_t>(m_sequenceNumber >> 8);
+        *h++ = static_cast<uint8_t>(m_sequenceNumber & 0xFF);
+        for (uint32_t shift{24}, i{0}; i < 4; i++, shift -= 8) {
+            *h++ = static_cast<uint8_t>((timeStamp >> shift) & 0xFF);
+        }
+        for (uint32_t shift{24}, i{0}; i < 4; i++, shift -= 8) {
+            *h++ = static_cast<uint8_t>((m_ssrc >> shift) & 0xFF);
+        }
+
+        if (m_vp8) {
+            // X, S on the first packet of the frame, partition 0; I, and L and T with temporal layers.
+            *h++ = static_cast<uint8_t>(0x80 | (first ? 0x10 : 0x00));
+            *h++ = static_cast<uint8_t>(0x80 | (m_layered ? 0x60 : 0x00));
+            *h++ = static_cast<uint8_t>(0x80 | (m_pictureId >> 8));
+            *h++ = static_cast<uint8_t>(m_pictureId & 0xFF);
+            if (m_layered) {
+                *h++ = m_tl0PicIdx;
+                *h++ = static_cast<uint8_t>((frame.temporalLayer & 0x03) << 6);
+            }
+        }
+        else {
+            // I, P for inter-picture predicted frames, L with layers, B and E for the frame's boundaries,
+            // and V for the scalability structure on the first packet of a keyframe.
+            const bool SS{first && frame.keyFrame && (0 == frame.spatialLayer)};
+            *h++ = static_cast<uint8_t>(0x80 | (frame.keyFrame ? 0x00 : 0x40) | (m_layered ? 0x20 : 0x00)
+                                        | (first ? 0x08 : 0x00) | (last ? 0x04 : 0x00) | (SS ? 0x02 : 0x00));
+            *h++ = static_cast<uint8_t>(0x80 | (m_pictureId >> 8));
+            *h++ = static_cast<uint8_t>(m_pictureId & 0xFF);
+            if (m_layered) {
+                // Upper spatial layers depend on the layer below.
+                *h++ = static_cast<uint8_t>(((frame.temporalLayer & 0x07) << 5) | ((frame.spatialLayer & 0x07) << 1)
+                                            | ((0 < frame.spatialLayer) ? 0x01 : 0x00));
+                *h++ = m_tl0PicIdx;
+            }
+            if (SS) {
+                *h++ = static_cast<uint8_t>((((m_spatialSizes.size() - 1) & 0x07) << 5) | 0x10);
+                for (auto &s : m_spatialSizes) {
+                    *h++ = static_cast<uint8_t>((s.first >> 8) & 0xFF);
+                    *h++ = static_cast<uint8_t>(s.first & 0xFF);
+                    *h++ = static_cast<uint8_t>((s.second >> 8) & 0xFF);
+                    *h++ = static_cast<uint8_t>(s.second & 0xFF);
+                }
+            }
+        }
+        return static_cast<uint32_t>(h - m_header);
+    }
+
+   private:
+    static constexpr uint32_t RTP_HEADER_SIZE{12};
+    static constexpr uint32_t MIN_MTU{256};
+
+    int32_t m_socket{-1};
+    struct sockaddr_in m_sendToAddress;
+
+    const bool m_vp8;
+    const uint8_t m_payloadType;
+    const uint32_t m_mtu;
+    const std::vector<std::pair<uint32_t, uint32_t> > m_spatialSizes;
+    const bool m_layered;
+
+    uint32_t m_ssrc{0};
+    uint16_t m_sequenceNumber{0};
+    uint32_t m_timeStampOffset{0};
+    uint16_t m_pictureId{0};
+    uint8_t m_tl0PicIdx{0};
+    uint64_t m_packetsSent{0};
+    uint8_t m_header[64]{};
+};
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SOURCE_HPP
+#define SOURCE_HPP
+
+#include "cluon-complete.hpp"
+#include "duplicate-frame-detector.hpp"
+#include "frame-pool.hpp"
+#include "frame-transform.hpp"
+#include "frame-waiter.hpp"
+#include "input-format.hpp"
+#include "static-scene-detector.hpp"
+
+#include <vpx/vpx_image.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/**
+ * Frame as taken from the shared memory area.
+ */
+struct CapturedFrame {
+    uint32_t index{0};
+    cluon::data::TimeStamp sampleTimeStamp{};
+    cluon::data::TimeStamp locked{};
+    cluon::data::TimeStamp unlocked{};
+    bool unchanged{false};
+};
+
+/**
+ * Shared memory area to encode frames from.
+ */
+struct Source {
+    Source(const std::string &name, uint32_t w, uint32_t h, const std::string &format, uint32_t stride, uint32_t planeHeight, const FrameTransform::Geometry &geometry, uint32_t poolSize) noexcept
+        : sharedMemory{std::make_shared<cluon::SharedMemory>(name)}
+        , input{format, w, h, stride, planeHeight}
+        , transform{input, w, h, geometry}
+        , width{transform.width()}
+        , height{transform.height()}
+        , framePool{width, height, poolSize} {}
+
+    std::shared_ptr<cluon::SharedMemory> sharedMemory;
+    InputFormat input;
+    FrameTransform transform;
+    const uint32_t width;   // Size of the frames after transforming them.
+    const uint32_t height;
+    vpx_image_t yuvFrame{};  // Wraps the shared memory when encoding without copy.
+    FramePool framePool;     // Only allocated when copying or transforming the frames out.
+    uint32_t numberOfLayers{0};
+    std::unique_ptr<StaticSceneDetector> detector{};  // Only set with --static-threshold.
+    std::unique_ptr<DuplicateFrameDetector> duplicates{};
+
+    // Used by the thread capturing from this area; waits with a deadline for --fps and --stale-timeout.
+    std::unique_ptr<FrameWaiter> waiter{};
+    std::chrono::steady_clock::time_point nextTick{};
+    std::chrono::steady_clock::time_point lastFrame{};
+    std::chrono::steady_clock::time_point lastStaleReport{};
+    bool stale{false};
+};
+
+#endif
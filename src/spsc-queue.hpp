@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SPSC_QUEUE_HPP
+#define SPSC_QUEUE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+/**
+ * This class is a bounded, lock-free queue for exactly one producer thread
+ * and exactly one consumer thread. All memory is allocated at construction.
+ */
+template <typename T>
+class SPSCQueue {
+   private:
+    SPSCQueue(const SPSCQueue &) = delete;
+    SPSCQueue(SPSCQueue &&)      = delete;
+    SPSCQueue &operator=(const SPSCQueue &) = delete;
+    SPSCQueue &operator=(SPSCQueue &&) = delete;
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param capacity Maximum number of elements in this queue.
+     */
+    explicit SPSCQueue(uint32_t capacity) noexcept
+        : m_buffer(capacity + 1) {}
+
+    /**
+     * This method is only allowed to be called from the producer thread.
+     *
+     * @param v Element to append.
+     * @return true if the element was appended; false if the queue is full.
+     */
+    bool push(const T &v) noexcept {
+        const uint32_t TAIL{m_tail.load(std::memory_order_relaxed)};
+        const uint32_t NEXT{increment(TAIL)};
+        if (NEXT == m_head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        m_buffer[TAIL] = v;
+        m_tail.store(NEXT, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * This method is only allowed to be called from the consumer thread.
+     *
+     * @param v Element to be filled with the oldest element.
+     * @return true if an element was removed; false if the queue is empty.
+     */
+    bool pop(T &v) noexcept {
+        const uint32_t HEAD{m_head.load(std::memory_order_relaxed)};
+        if (HEAD == m_tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        v = m_buffer[HEAD];
+        m_head.store(increment(HEAD), std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * This method is only allowed to be called from the consumer thread; it
+     * waits until an element is available or until the timeout expired.
+     *
+     * @param v Element to be filled with the oldest element.
+     * @param timeout Maximum time to wait.
+     * @return true if an element was removed; false on timeout.
+     */
+    bool pop(T &v, const std::chrono::microseconds &timeout) noexcept {
+        const auto UNTIL{std::chrono::steady_clock::now() + timeout};
+        while (!pop(v)) {
+            if (std::chrono::steady_clock::now() > UNTIL) {
+                return false;
+            }
+            std::this_thread::sleep_for(POLL_INTERVAL);
+        }
+        return true;
+    }
+
+   private:
+    uint32_t increment(uint32_t i) const noexcept {
+        return (i + 1) % static_cast<uint32_t>(m_buffer.size());
+    }
+
+   private:
+    static constexpr std::chrono::microseconds POLL_INTERVAL{100};
+
+    std::vector<T> m_buffer;
+    // Keep head and tail on separate cache lines to avoid false sharing.
+    std::atomic<uint32_t> m_head{0};
+    char m_padding[64 - sizeof(std::atomic<uint32_t>)]{};
+    std::atomic<uint32_t> m_tail{0};
+};
+
+template <typename T>
+constexpr std::chrono::microseconds SPSCQueue<T>::POLL_INTERVAL;
+
+#endif
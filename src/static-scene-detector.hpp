@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STATIC_SCENE_DETECTOR_HPP
+#define STATIC_SCENE_DETECTOR_HPP
+
+#include <vpx/vpx_image.h>
+#include <libyuv.h>
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * This class tells whether a frame differs from the previous one. The luma
+ * plane is box-filtered down by 8 in both directions with libyuv, which also
+ * averages out sensor noise, and the sum of absolute differences to the
+ * previous decimated plane is compared against a threshold for the mean
+ * absolute difference per sample. Working on 1/64 of the samples keeps the
+ * cost far below that of encoding the frame.
+ */
+class StaticSceneDetector {
+   private:
+    StaticSceneDetector(const StaticSceneDetector &) = delete;
+    StaticSceneDetector(StaticSceneDetector &&)      = delete;
+    StaticSceneDetector &operator=(const StaticSceneDetector &) = delete;
+    StaticSceneDetector &operator=(StaticSceneDetector &&) = delete;
+
+   public:
+    /**
+     * Constructor.
+     *
+     * @param width Width of the frames.
+     * @param height Height of the frames.
+     * @param threshold Mean absolute difference of the decimated luma samples up to which a frame is unchanged.
+     */
+    StaticSceneDetector(uint32_t width, uint32_t height, double threshold) noexcept
+        : m_width{(DECIMATION < width) ? width / DECIMATION : 1}
+        , m_height{(DECIMATION < height) ? height / DECIMATION : 1}
+        , m_threshold{static_cast<uint64_t>(threshold * m_width * m_height)}
+        , m_current(m_width * m_height, 0)
+        , m_previous(m_width * m_height, 0) {}
+
+    /**
+     * This method compares the given frame with the previous one; the first
+     * frame is never unchanged.
+     *
+     * @param frame Frame to compare.
+     * @return true if the frame is unchanged.
+     */
+    bool unchanged(const vpx_image_t *frame) noexcept {
+        libyuv::ScalePlane(frame->planes[VPX_PLANE_Y], frame->stride[VPX_PLANE_Y],
+                           static_cast<int32_t>(frame->d_w), static_cast<int32_t>(frame->d_h),
+                           m_current.data(), static_cast<int32_t>(m_width),
+                           static_cast<int32_t>(m_width), static_cast<int32_t>(m_height),
+                           libyuv::kFilterBox);
+        uint64_t sad{0};
+        const uint8_t *a{m_current.data()};
+        const uint8_t *b{m_previous.data()};
+        for (uint32_t i{0}; i < m_current.size(); i++) {
+            sad += static_cast<uint64_t>((a[i] > b[i]) ? a[i] - b[i] : b[i] - a[i]);
+        }
+        m_current.swap(m_previous);
+
+        const bool retVal{m_initialized && (sad <= m_threshold)};
+        m_initialized = true;
+        m_difference = static_cast<double>(sad) / static_cast<double>(m_width * m_height);
+        return retVal;
+    }
+
+    /**
+     * @return Mean absolute difference of the last comparison.
+     */
+    double difference() const noexcept {
+        return m_difference;
+    }
+
+   private:
+    static constexpr uint32_t DECIMATION{8};
+
+    const uint32_t m_width;
+    const uint32_t m_height;
+    const uint64_t m_threshold;
+    std::vector<uint8_t> m_current;
+    std::vector<uint8_t> m_previous;
+    bool m_initialized{false};
+    double m_difference{0.0};
+};
+
+#endif
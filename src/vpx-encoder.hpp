@@ -0,0 +1,332 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VPX_ENCODER_HPP
+#define VPX_ENCODER_HPP
+
+#include "cluon-complete.hpp"
+#include "encoded-frame.hpp"
+
+#include <vpx/vpx_encoder.h>
+#include <vpx/vp8cx.h>
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+/**
+ * This class wraps one libvpx encoder instance. With temporal layers, the
+ * reference structure for VP8 is driven from here as in libvpx's example
+ * vpx_temporal_svc_encoder; VP9 applies its own temporal layering mode.
+ */
+class VpxEncoder {
+   private:
+    VpxEncoder(const VpxEncoder &) = delete;
+    VpxEncoder(VpxEncoder &&)      = delete;
+    VpxEncoder &operator=(const VpxEncoder &) = delete;
+    VpxEncoder &operator=(VpxEncoder &&) = delete;
+
+   public:
+    VpxEncoder() noexcept
+        : m_codec()
+        , m_parameters() {
+        memset(&m_codec, 0, sizeof(m_codec));
+        memset(&m_parameters, 0, sizeof(m_parameters));
+    }
+
+    ~VpxEncoder() noexcept {
+        if (m_initialized) {
+            vpx_codec_destroy(&m_codec);
+        }
+    }
+
+    /**
+     * This method initializes the encoder.
+     *
+     * @param encoderAlgorithm VP8 or VP9 encoder interface.
+     * @param parameters Configuration.
+     * @return Result from vpx_codec_enc_init.
+     */
+    vpx_codec_err_t init(vpx_codec_iface_t *encoderAlgorithm, const vpx_codec_enc_cfg_t &parameters) noexcept {
+        m_parameters = parameters;
+        m_vp8 = (&vpx_codec_vp8_cx_algo == encoderAlgorithm);
+        vpx_codec_err_t result = vpx_codec_enc_init(&m_codec, encoderAlgorithm, &m_parameters, 0);
+        m_initialized = (VPX_CODEC_OK == result);
+        return result;
+    }
+
+    /**
+     * This method changes the configuration of the running encoder.
+     *
+     * @param parameters New configuration.
+     * @return Result from vpx_codec_enc_config_set.
+     */
+    vpx_codec_err_t reconfigure(const vpx_codec_enc_cfg_t &parameters) noexcept {
+        vpx_codec_err_t result = vpx_codec_enc_config_set(&m_codec, &parameters);
+        if (VPX_CODEC_OK == result) {
+            m_parameters = parameters;
+        }
+        return result;
+    }
+
+    /**
+     * This method sets up the temporal layer pattern in the given configuration;
+     * the target bitrates per layer need to be set by the caller.
+     *
+     * @param numberOfLayers Number of temporal layers [1 .. 3].
+     * @param parameters Configuration to modify.
+     */
+    static void configureTemporalLayers(uint32_t numberOfLayers, vpx_codec_enc_cfg_t &parameters) noexcept {
+        if (3 == numberOfLayers) {
+            // Frame rates 1/4, 1/2, and 1 with the pattern 0, 2, 1, 2.
+            parameters.ts_number_layers = 3;
+            parameters.ts_periodicity = 4;
+            parameters.ts_layer_id[0] = 0;
+            parameters.ts_layer_id[1] = 2;
+            parameters.ts_layer_id[2] = 1;
+            parameters.ts_layer_id[3] = 2;
+            parameters.ts_rate_decimator[0] = 4;
+            parameters.ts_rate_decimator[1] = 2;
+            parameters.ts_rate_decimator[2] = 1;
+            parameters.temporal_layering_mode = VP9E_TEMPORAL_LAYERING_MODE_0212;
+        }
+        else if (2 == numberOfLayers) {
+            // Frame rates 1/2 and 1 with the pattern 0, 1.
+            parameters.ts_number_layers = 2;
+            parameters.ts_periodicity = 2;
+            parameters.ts_layer_id[0] = 0;
+            parameters.ts_layer_id[1] = 1;
+            parameters.ts_rate_decimator[0] = 2;
+            parameters.ts_rate_decimator[1] = 1;
+            parameters.temporal_layering_mode = VP9E_TEMPORAL_LAYERING_MODE_0101;
+        }
+        else {
+            parameters.ts_number_layers = 1;
+            parameters.ts_periodicity = 1;
+            parameters.ts_layer_id[0] = 0;
+            parameters.ts_rate_decimator[0] = 1;
+            parameters.temporal_layering_mode = VP9E_TEMPORAL_LAYERING_MODE_NOLAYERING;
+        }
+    }
+
+    /**
+     * This method chooses the number of VP9 tile columns: as many as there are
+     * threads but none narrower than the 256 pixels that VP9 allows.
+     *
+     * @param width Width of the frame.
+     * @param threads Number of encoder threads.
+     * @return log2 of the number of tile columns as for VP9E_SET_TILE_COLUMNS.
+     */
+    static uint32_t tileColumns(uint32_t width, uint32_t threads) noexcept {
+        const uint32_t MIN_TILE_WIDTH{256};
+        const uint32_t MAX_LOG2_TILE_COLUMNS{6};
+        uint32_t log2{0};
+        while ((log2 < MAX_LOG2_TILE_COLUMNS) && ((2u << log2) <= threads) && (MIN_TILE_WIDTH <= (width >> (log2 + 1)))) {
+            log2++;
+        }
+        return log2;
+    }
+
+    /**
+     * @return Encoder context to be used with vpx_codec_control.
+     */
+    vpx_codec_ctx_t *codec() noexcept {
+        return &m_codec;
+    }
+
+    /**
+     * @return Configuration the encoder was initialized with.
+     */
+    const vpx_codec_enc_cfg_t &parameters() const noexcept {
+        return m_parameters;
+    }
+
+    /**
+     * This method encodes the given frame and collects the resulting packets
+     * in out; out.size is 0 if the encoder did not produce a frame. Unless copy
+     * is set, out.payload points to the encoder's output buffer for frames
+     * consisting of a single packet, which is valid until the next call.
+     * out.data grows if a frame exceeds it; a frame that cannot be held is
+     * dropped entirely.
+     * A forced keyframe restarts the temporal layer pattern.
+     *
+     * @param frame Frame to encode.
+     * @param pts Presentation time stamp.
+     * @param duration Duration of this frame.
+     * @param flags Encoding flags.
+     * @param out Encoded frame.
+     * @param copy True if the frame must be copied into out.data.
+     * @return Result from vpx_codec_encode.
+     */
+    vpx_codec_err_t encode(const vpx_image_t *frame, vpx_codec_pts_t pts, unsigned long duration, vpx_enc_frame_flags_t flags, EncodedFrame &out, bool copy) noexcept {
+        out.payload = &out.data[0];
+        out.size = 0;
+        out.pts = static_cast<int64_t>(pts);
+        out.keyFrame = false;
+        out.temporalLayer = 0;
+
+        const uint32_t PERIODICITY{(1 < m_parameters.ts_number_layers) ? m_parameters.ts_periodicity : 1};
+        if (0 != (flags & VPX_EFLAG_FORCE_KF)) {
+            m_patternIndex = 0;
+        }
+        if (1 < PERIODICITY) {
+            out.temporalLayer = m_parameters.ts_layer_id[m_patternIndex];
+            if (m_vp8) {
+                // Frames never reference a buffer that is updated by a higher layer.
+                flags |= vp8TemporalLayerFlags(m_parameters.ts_number_layers, m_patternIndex);
+                vpx_codec_control(&m_codec, VP8E_SET_TEMPORAL_LAYER_ID, static_cast<int>(out.temporalLayer));
+            }
+            m_patternIndex = (m_patternIndex + 1) % PERIODICITY;
+        }
+
+        cluon::data::TimeStamp before{cluon::time::now()};
+        vpx_codec_err_t result = vpx_codec_encode(&m_codec, frame, pts, duration, flags, VPX_DL_REALTIME);
+        cluon::data::TimeStamp after{cluon::time::now()};
+        out.encodingDuration = cluon::time::deltaInMicroseconds(after, before);
+
+        if (!result) {
+            vpx_codec_iter_t it{nullptr};
+            const vpx_codec_cx_pkt_t *packet{nullptr};
+
+            // Packets after a dropped one are fetched but not used.
+            bool dropped{false};
+            while ((packet = vpx_codec_get_cx_data(&m_codec, &it))) {
+                if (dropped) {
+                    continue;
+                }
+                switch (packet->kind) {
+                    case VPX_CODEC_CX_FRAME_PKT:
+                        if (!copy && (0 == out.size)) {
+                            out.payload = static_cast<const char*>(packet->data.frame.buf);
+                            out.size = static_cast<uint32_t>(packet->data.frame.sz);
+                        }
+                        else {
+                            const bool IN_DATA{out.payload == &out.data[0]};
+                            if (!grow(out, out.size + packet->data.frame.sz)) {
+                                std::cerr << "[opendlv-video-vpx-encoder]: Failed to hold encoded frame of " << (out.size + packet->data.frame.sz) << " bytes; frame dropped." << std::endl;
+                                out.payload = &out.data[0];
+                                out.size = 0;
+                                out.keyFrame = false;
+                                dropped = true;
+                                break;
+                            }
+                            if (!IN_DATA) {
+                                // Further packets follow; move the first one into our buffer.
+                                memmove(&out.data[0], out.payload, out.size);
+                            }
+                            out.payload = &out.data[0];
+                            memcpy(&out.data[out.size], packet->data.frame.buf, packet->data.frame.sz);
+                            out.size += static_cast<uint32_t>(packet->data.frame.sz);
+                        }
+                        out.keyFrame |= (0 != (packet->data.frame.flags & VPX_FRAME_IS_KEY));
+                    break;
+                default:
+                    break;
+                }
+            }
+
+            if (!m_vp8 && (1 < PERIODICITY)) {
+                vpx_svc_layer_id_t layerId;
+                memset(&layerId, 0, sizeof(layerId));
+                if (VPX_CODEC_OK == vpx_codec_control(&m_codec, VP9E_GET_SVC_LAYER_ID, &layerId)) {
+                    out.temporalLayer = static_cast<uint32_t>(layerId.temporal_layer_id);
+                }
+            }
+        }
+        return result;
+    }
+
+    /**
+     * This method reads the index of a VP9 superframe, which carries the
+     * frames of all spatial layers encoded for one picture.
+     *
+     * @param data Encoded VP9 frame.
+     * @param size Size of data.
+     * @param sizes Sizes of the contained frames in order.
+     * @param maxFrames Capacity of sizes.
+     * @return Number of contained frames or 0 if data is not a superframe.
+     */
+    static uint32_t superframe(const char *data, uint32_t size, uint32_t *sizes, uint32_t maxFrames) noexcept {
+        if (0 == size) {
+            return 0;
+        }
+        const uint8_t *d{reinterpret_cast<const uint8_t*>(data)};
+        const uint8_t MARKER{d[size - 1]};
+        if (0xc0 != (MARKER & 0xe0)) {
+            return 0;
+        }
+        const uint32_t FRAMES{(MARKER & 0x7u) + 1};
+        const uint32_t MAGNITUDE{((MARKER >> 3) & 0x3u) + 1};
+        const uint32_t INDEX_SIZE{2 + MAGNITUDE * FRAMES};
+        if ((size < INDEX_SIZE) || (MARKER != d[size - INDEX_SIZE]) || (FRAMES > maxFrames)) {
+            return 0;
+        }
+
+        uint32_t total{0};
+        const uint8_t *x{d + size - INDEX_SIZE + 1};
+        for (uint32_t i{0}; i < FRAMES; i++) {
+            uint32_t s{0};
+            for (uint32_t j{0}; j < MAGNITUDE; j++) {
+                s |= static_cast<uint32_t>(*x++) << (j * 8);
+            }
+            sizes[i] = s;
+            total += s;
+        }
+        return (total + INDEX_SIZE <= size) ? FRAMES : 0;
+    }
+
+   private:
+    // Grows out.data to hold at least size bytes; out.payload is not adjusted.
+    static bool grow(EncodedFrame &out, std::size_t size) noexcept {
+        if (size <= out.data.size()) {
+            return true;
+        }
+        try {
+            out.data.resize(size + size / 4);
+        }
+        catch (...) {
+            return false;
+        }
+        return true;
+    }
+
+    static vpx_enc_frame_flags_t vp8TemporalLayerFlags(uint32_t numberOfLayers, uint32_t patternIndex) noexcept {
+        // Layer 0 only uses LAST, layer 1 of three updates GF, and the top layer is never
+        // referenced; no upper layer updates the entropy context so that it can be dropped.
+        const vpx_enc_frame_flags_t LAYER0{VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF};
+        const vpx_enc_frame_flags_t LAYER1{VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_LAST | VP8_EFLAG_NO_UPD_ARF | VP8_EFLAG_NO_UPD_ENTROPY};
+        const vpx_enc_frame_flags_t TOP_LAYER{VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_LAST | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF | VP8_EFLAG_NO_UPD_ENTROPY};
+
+        vpx_enc_frame_flags_t flags{LAYER0};
+        if (2 == numberOfLayers) {
+            flags = (0 == patternIndex) ? LAYER0 : (TOP_LAYER | VP8_EFLAG_NO_REF_GF);
+        }
+        else if (3 == numberOfLayers) {
+            flags = (0 == patternIndex) ? LAYER0 : ((2 == patternIndex) ? LAYER1 : TOP_LAYER);
+        }
+        return flags;
+    }
+
+   private:
+    vpx_codec_ctx_t m_codec;
+    vpx_codec_enc_cfg_t m_parameters;
+    bool m_initialized{false};
+    bool m_vp8{false};
+    uint32_t m_patternIndex{0};
+};
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WAKEUP_HPP
+#define WAKEUP_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+/**
+ * This class lets threads sleep while they have nothing to do until another
+ * thread signals new work, e.g., after pushing into an SPSCQueue, which stays
+ * lock-free. A waiting thread takes the generation before looking for work
+ * and, if it found none, waits for a newer generation; as a signal that came
+ * in between has already advanced the generation, no signal is lost.
+ *
+ * Example:
+ * @code
+ * Wakeup wakeup;
+ * // Consumer:
+ * const uint64_t GENERATION{wakeup.generation()};
+ * if (!queue.pop(v)) {
+ *     wakeup.wait(GENERATION, std::chrono::milliseconds(100));
+ * }
+ * // Producer:
+ * queue.push(v);
+ * wakeup.notify();
+ * @endcode
+ */
+class Wakeup {
+   private:
+    Wakeup(const Wakeup &) = delete;
+    Wakeup(Wakeup &&)      = delete;
+    Wakeup &operator=(const Wakeup &) = delete;
+    Wakeup &operator=(Wakeup &&) = delete;
+
+   public:
+    Wakeup() = default;
+
+    /**
+     * @return Current generation, to be taken before looking for work.
+     */
+    uint64_t generation() const noexcept {
+        return m_generation.load(std::memory_order_acquire);
+    }
+
+    /**
+     * This method wakes all waiting threads.
+     */
+    void notify() noexcept {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_generation.fetch_add(1, std::memory_order_release);
+        }
+        m_condition.notify_all();
+    }
+
+    /**
+     * This method waits until the generation differs from the given one or
+     * until the timeout expired.
+     *
+     * @param generation Generation taken before looking for work.
+     * @param timeout Maximum time to wait.
+     * @return true if notify() was called since the generation was taken.
+     */
+    bool wait(uint64_t generation, const std::chrono::microseconds &timeout) noexcept {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        return m_condition.wait_for(lock, timeout, [this, generation]() { return generation != m_generation.load(std::memory_order_relaxed); });
+    }
+
+   private:
+    std::mutex m_mutex{};
+    std::condition_variable m_condition{};
+    std::atomic<uint64_t> m_generation{0};
+};
+
+#endif
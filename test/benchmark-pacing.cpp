@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cluon-complete.hpp"
+#include "opendlv-standard-message-set.hpp"
+#include "opendlv-video-message-set.hpp"
+#include "envelope-sender.hpp"
+#include "image-reading-fragments.hpp"
+#include "pacer.hpp"
+#include "rtp-sender.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Time of arrival in microseconds and size of a received datagram.
+using Arrival = std::pair<int64_t, uint32_t>;
+
+int64_t now() noexcept {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Records the arrival of the datagrams sent to a loopback port.
+class Receiver {
+   private:
+    Receiver(const Receiver &) = delete;
+    Receiver(Receiver &&)      = delete;
+    Receiver &operator=(const Receiver &) = delete;
+    Receiver &operator=(Receiver &&) = delete;
+
+   public:
+    explicit Receiver(std::size_t expectedDatagrams) noexcept {
+        m_arrivals.reserve(expectedDatagrams);
+        m_socket = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        struct sockaddr_in address{};
+        address.sin_family      = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port        = 0;
+        socklen_t length{sizeof(address)};
+        if ((0 <= m_socket)
+            && (0 == ::bind(m_socket, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)))
+            && (0 == ::getsockname(m_socket, reinterpret_cast<struct sockaddr *>(&address), &length))) {
+            m_port = ntohs(address.sin_port);
+            // Unpaced keyframes must not overflow the receive buffer.
+            const int BUFFER_SIZE{8 * 1024 * 1024};
+            ::setsockopt(m_socket, SOL_SOCKET, SO_RCVBUF, &BUFFER_SIZE, sizeof(BUFFER_SIZE));
+            struct timeval timeout{0, 100000};
+            ::setsockopt(m_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            m_thread = std::thread([this]() {
+                std::vector<char> buffer(Fragmenter::MAX_DATAGRAM_SIZE);
+                while (!m_stop.load()) {
+                    const ssize_t SIZE{::recv(m_socket, buffer.data(), buffer.size(), 0)};
+                    if (0 < SIZE) {
+                        m_arrivals.emplace_back(now(), static_cast<uint32_t>(SIZE));
+                    }
+                }
+            });
+        }
+    }
+
+    ~Receiver() {
+        stop();
+        if (0 <= m_socket) {
+            ::close(m_socket);
+        }
+    }
+
+    uint16_t port() const noexcept {
+        return m_port;
+    }
+
+    /**
+     * This method waits for the remaining datagrams and stops receiving.
+     *
+     * @return Arrivals of all datagrams.
+     */
+    const std::vector<Arrival> &stop() noexcept {
+        m_stop.store(true);
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+        return m_arrivals;
+    }
+
+   private:
+    int m_socket{-1};
+    uint16_t m_port{0};
+    std::atomic<bool> m_stop{false};
+    std::vector<Arrival> m_arrivals{};
+    std::thread m_thread{};
+};
+
+// Statistics of the datagrams of frames as seen by the receiver.
+struct Statistics {
+    uint32_t frames{0};
+    uint64_t datagrams{0};
+    uint64_t sumOfMaxBursts{0};
+    uint32_t maxBurst{0};
+    int64_t gaps{0};
+    int64_t sumOfGaps{0};
+    int64_t maxGap{0};
+    int64_t sumOfDurations{0};
+};
+
+void print(const char *transport, bool paced, const char *frames, const Statistics &s) noexcept {
+    const double N{static_cast<double>(std::max(s.frames, 1u))};
+    char line[160];
+    snprintf(line, sizeof(line), "%-9s  %6s  %-8s  %6u  %15.1f  %14.0f  %14u  %13.1f  %13lld  %13.2f", transport, (paced ? "yes" : "no"), frames, s.frames,
+             static_cast<double>(s.datagrams) / N, static_cast<double>(s.sumOfMaxBursts) / N, s.maxBurst,
+             (0 < s.gaps) ? static_cast<double>(s.sumOfGaps) / static_cast<double>(s.gaps) : 0.0, static_cast<long long>(s.maxGap),
+             static_cast<double>(s.sumOfDurations) / N / 1000.0);
+    std::cout << line << std::endl;
+}
+
+} // namespace
+
+// Sends a synthetic sequence of keyframes and delta frames through Fragmenter and RtpSender to
+// loopback with and without a Pacer and reports the bursts and gaps between the datagrams.
+int32_t main(int32_t argc, char **argv) {
+    int32_t retCode{0};
+    auto commandlineArguments = cluon::getCommandlineArguments(argc, argv);
+    if (0 != commandlineArguments.count("help")) {
+        std::cerr << argv[0] << " measures the bursts and gaps between the datagrams of frames sent with and without pacing." << std::endl;
+        std::cerr << "Usage:   " << argv[0] << " [--frames=<frames>] [--gop=<GOP>] [--keyframe-size=<bytes>] [--frame-size=<bytes>] [--bitrate=<bitrate>] [--fps=<Hz>] [--mtu=<bytes>] [--rtp-mtu=<bytes>] [--pacing=<fraction>] [--fec=<fragments>] [--burst-gap=<us>]" << std::endl;
+        std::cerr << "         --frames:        frames to send per run (default: 90)" << std::endl;
+        std::cerr << "         --gop:           distance between keyframes (default: 30)" << std::endl;
+        std::cerr << "         --keyframe-size: size of a keyframe (default: 150000)" << std::endl;
+        std::cerr << "         --frame-size:    size of a delta frame (default: 12000)" << std::endl;
+        std::cerr << "         --bitrate:       target bitrate in bps (default: 4000000)" << std::endl;
+        std::cerr << "         --fps:           frame rate (default: 30)" << std::endl;
+        std::cerr << "         --mtu:           maximum size of a fragment's datagram (default: 1400)" << std::endl;
+        std::cerr << "         --rtp-mtu:       maximum size of an RTP packet (default: 1200)" << std::endl;
+        std::cerr << "         --pacing:        fraction of the frame interval to send a frame in (default: 0.5)" << std::endl;
+        std::cerr << "         --fec:           fragments per parity fragment (default: 0)" << std::endl;
+        std::cerr << "         --burst-gap:     largest gap between datagrams of a burst in microseconds (default: 20)" << std::endl;
+        std::cerr << "Example: " << argv[0] << " --keyframe-size=300000 --pacing=0.3" << std::endl;
+        retCode = 1;
+    }
+    else {
+        const uint32_t FRAMES{(commandlineArguments["frames"].size() != 0) ? std::max(1u, static_cast<uint32_t>(std::stoi(commandlineArguments["frames"]))) : 90};
+        const uint32_t GOP{(commandlineArguments["gop"].size() != 0) ? std::max(1u, static_cast<uint32_t>(std::stoi(commandlineArguments["gop"]))) : 30};
+        const uint32_t KEYFRAME_SIZE{(commandlineArguments["keyframe-size"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["keyframe-size"])) : 150000};
+        const uint32_t FRAME_SIZE{(commandlineArguments["frame-size"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["frame-size"])) : 12000};
+        const uint32_t BITRATE{(commandlineArguments["bitrate"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["bitrate"])) : 4000000};
+        const uint32_t FPS{(commandlineArguments["fps"].size() != 0) ? std::max(1u, static_cast<uint32_t>(std::stoi(commandlineArguments["fps"]))) : 30};
+        const uint32_t MTU{(commandlineArguments["mtu"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["mtu"])) : 1400};
+        const uint32_t RTP_MTU{(commandlineArguments["rtp-mtu"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["rtp-mtu"])) : 1200};
+        const double PACING{(commandlineArguments["pacing"].size() != 0) ? std::stod(commandlineArguments["pacing"]) : 0.5};
+        const uint32_t FEC{(commandlineArguments["fec"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["fec"])) : 0};
+        const int64_t BURST_GAP{(commandlineArguments["burst-gap"].size() != 0) ? std::stoi(commandlineArguments["burst-gap"]) : 20};
+        const int64_t FRAME_INTERVAL{1000000 / FPS};
+
+        std::mt19937 random{1};
+        std::vector<char> data(std::max(KEYFRAME_SIZE, FRAME_SIZE));
+        for (auto &c : data) {
+            c = static_cast<char>(random());
+        }
+
+        std::cout << "Sending " << FRAMES << " frames at " << FPS << " fps with a keyframe of " << KEYFRAME_SIZE << " bytes every " << GOP << " frames and delta frames of " << FRAME_SIZE
+                  << " bytes; pacing = " << PACING << ", bitrate = " << BITRATE << " bps, bursts are datagrams less than " << BURST_GAP << " microseconds apart" << std::endl;
+        char header[160];
+        snprintf(header, sizeof(header), "%-9s  %6s  %-8s  %6s  %15s  %14s  %14s  %13s  %13s  %13s", "transport", "paced", "frames", "number", "datagrams/frame",
+                 "mean burst [B]", "max. burst [B]", "mean gap [us]", "max. gap [us]", "duration [ms]");
+        std::cout << header << std::endl;
+
+        char imageReadingFields[32];
+        for (bool rtp : {false, true}) {
+            for (bool paced : {false, true}) {
+                const uint32_t DATAGRAM_SIZE{rtp ? RTP_MTU : MTU};
+                Receiver receiver{static_cast<std::size_t>(FRAMES) * (KEYFRAME_SIZE / DATAGRAM_SIZE * 2 + 16)};
+                if (0 == receiver.port()) {
+                    std::cerr << "[opendlv-video-vpx-encoder]: Failed to bind to loopback." << std::endl;
+                    return 1;
+                }
+                EnvelopeSender sender{"127.0.0.1", receiver.port()};
+                Fragmenter fragmenter{MTU};
+                RtpSender rtpSender{"127.0.0.1", receiver.port(), true, 96, RTP_MTU, {{1280, 720}}, 1};
+                std::unique_ptr<Pacer> pacer{paced ? new Pacer{PACING} : nullptr};
+
+                // Frames are sent at the frame rate; the start of every frame splits the arrivals.
+                std::vector<int64_t> frameStarts;
+                int64_t next{now()};
+                for (uint32_t n{0}; n < FRAMES; n++) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(std::max<int64_t>(0, next - now())));
+                    next += FRAME_INTERVAL;
+
+                    const bool KEY_FRAME{0 == (n % GOP)};
+                    const uint32_t SIZE{KEY_FRAME ? KEYFRAME_SIZE : FRAME_SIZE};
+                    frameStarts.push_back(now());
+                    if (pacer) {
+                        pacer->frame(SIZE + ((!rtp && (1 < FEC)) ? SIZE / FEC : 0), BITRATE, FRAME_INTERVAL);
+                    }
+                    if (rtp) {
+                        RtpSender::Frame frame;
+                        frame.sampleTimeStamp = static_cast<int64_t>(n) * FRAME_INTERVAL;
+                        frame.keyFrame = KEY_FRAME;
+                        rtpSender.send(data.data(), SIZE, frame, pacer.get());
+                    }
+                    else {
+                        ProtoWriter fields{imageReadingFields, sizeof(imageReadingFields)};
+                        fields.bytes(1, "VP80", 4).varInt(2, 1280).varInt(3, 720).bytesHeader(4, SIZE);
+                        struct iovec parts[2];
+                        parts[0].iov_base = imageReadingFields;
+                        parts[0].iov_len = fields.size();
+                        parts[1].iov_base = data.data();
+                        parts[1].iov_len = SIZE;
+                        cluon::data::TimeStamp sampleTimeStamp{cluon::time::now()};
+                        fragmenter.send(sender, opendlv::proxy::ImageReading::ID(), parts, 2, sampleTimeStamp, 0, pacer.get(), FEC);
+                    }
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(FRAME_INTERVAL));
+                const std::vector<Arrival> &arrivals{receiver.stop()};
+
+                Statistics statistics[2];
+                std::size_t i{0};
+                for (uint32_t n{0}; n < FRAMES; n++) {
+                    const int64_t END{(n + 1 < FRAMES) ? frameStarts[n + 1] : INT64_MAX};
+                    Statistics &s{statistics[(0 == (n % GOP)) ? 0 : 1]};
+                    const std::size_t FIRST{i};
+                    uint32_t burst{0};
+                    uint32_t maxBurst{0};
+                    for (; (i < arrivals.size()) && (arrivals[i].first < END); i++) {
+                        if (FIRST < i) {
+                            const int64_t GAP{arrivals[i].first - arrivals[i - 1].first};
+                            s.gaps++;
+                            s.sumOfGaps += GAP;
+                            s.maxGap = std::max(s.maxGap, GAP);
+                            burst = (GAP < BURST_GAP) ? burst : 0;
+                        }
+                        burst += arrivals[i].second;
+                        maxBurst = std::max(maxBurst, burst);
+                    }
+                    if (FIRST < i) {
+                        s.frames++;
+                        s.datagrams += i - FIRST;
+                        s.sumOfMaxBursts += maxBurst;
+                        s.maxBurst = std::max(s.maxBurst, maxBurst);
+                        s.sumOfDurations += arrivals[i - 1].first - arrivals[FIRST].first;
+                    }
+                }
+                print(rtp ? "RTP" : "fragments", paced, "keyframe", statistics[0]);
+                print(rtp ? "RTP" : "fragments", paced, "delta", statistics[1]);
+            }
+        }
+    }
+    return retCode;
+}
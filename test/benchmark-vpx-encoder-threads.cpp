@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cluon-complete.hpp"
+#include "encoded-frame.hpp"
+#include "vpx-encoder.hpp"
+
+#include <vpx/vpx_encoder.h>
+#include <vpx/vp8cx.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Encodes the same synthetic sequence with 1 .. N threads and reports the encoding time per frame.
+int32_t main(int32_t argc, char **argv) {
+    int32_t retCode{0};
+    auto commandlineArguments = cluon::getCommandlineArguments(argc, argv);
+    if (0 != commandlineArguments.count("help")) {
+        std::cerr << argv[0] << " measures how the encoding time of VP9 (or VP8) frames scales with the number of encoder threads." << std::endl;
+        std::cerr << "Usage:   " << argv[0] << " [--width=<width>] [--height=<height>] [--frames=<frames>] [--threads=<maximum threads>] [--bitrate=<bitrate>] [--cpu-used=<cpu-used>] [--vp8]" << std::endl;
+        std::cerr << "         --width:    width of the frames (default: 1920)" << std::endl;
+        std::cerr << "         --height:   height of the frames (default: 1080)" << std::endl;
+        std::cerr << "         --frames:   frames to encode per number of threads (default: 300)" << std::endl;
+        std::cerr << "         --threads:  largest number of threads (default: number of cores)" << std::endl;
+        std::cerr << "         --bitrate:  target bitrate in bps (default: 4000000)" << std::endl;
+        std::cerr << "         --cpu-used: encoder speed (default: 6 for VP9, 8 for VP8)" << std::endl;
+        std::cerr << "         --vp8:      use VP8 instead of VP9" << std::endl;
+        std::cerr << "Example: " << argv[0] << " --width=1920 --height=1080 --threads=8" << std::endl;
+        retCode = 1;
+    }
+    else {
+        const uint32_t WIDTH{(commandlineArguments["width"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["width"])) : 1920};
+        const uint32_t HEIGHT{(commandlineArguments["height"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["height"])) : 1080};
+        const uint32_t FRAMES{(commandlineArguments["frames"].size() != 0) ? std::max(1u, static_cast<uint32_t>(std::stoi(commandlineArguments["frames"]))) : 300};
+        const uint32_t MAX_THREADS{(commandlineArguments["threads"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["threads"])) : std::max(1u, std::thread::hardware_concurrency())};
+        const uint32_t BITRATE{(commandlineArguments["bitrate"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["bitrate"])) : 4000000};
+        const bool VP8{0 != commandlineArguments.count("vp8")};
+        const int32_t CPUUSED{(commandlineArguments["cpu-used"].size() != 0) ? std::stoi(commandlineArguments["cpu-used"]) : (VP8 ? 8 : 6)};
+        vpx_codec_iface_t *encoderAlgorithm{VP8 ? &vpx_codec_vp8_cx_algo : &vpx_codec_vp9_cx_algo};
+
+        // A texture of smooth noise that pans across the frame with some sensor noise on top.
+        const uint32_t CELL{16};
+        const uint32_t TEXTURE_WIDTH{2 * WIDTH};
+        const uint32_t TEXTURE_HEIGHT{2 * HEIGHT};
+        std::mt19937 random{1};
+        std::vector<unsigned char> grid((TEXTURE_WIDTH / CELL + 2) * (TEXTURE_HEIGHT / CELL + 2));
+        for (auto &g : grid) {
+            g = static_cast<unsigned char>(random());
+        }
+        const uint32_t GRID_WIDTH{TEXTURE_WIDTH / CELL + 2};
+        std::vector<unsigned char> texture(TEXTURE_WIDTH * TEXTURE_HEIGHT);
+        for (uint32_t y{0}; y < TEXTURE_HEIGHT; y++) {
+            for (uint32_t x{0}; x < TEXTURE_WIDTH; x++) {
+                const uint32_t GX{x / CELL}, GY{y / CELL}, FX{x % CELL}, FY{y % CELL};
+                const uint32_t TOP{grid[GY * GRID_WIDTH + GX] * (CELL - FX) + grid[GY * GRID_WIDTH + GX + 1] * FX};
+                const uint32_t BOTTOM{grid[(GY + 1) * GRID_WIDTH + GX] * (CELL - FX) + grid[(GY + 1) * GRID_WIDTH + GX + 1] * FX};
+                texture[y * TEXTURE_WIDTH + x] = static_cast<unsigned char>((TOP * (CELL - FY) + BOTTOM * FY) / (CELL * CELL));
+            }
+        }
+        std::vector<unsigned char> noise(WIDTH * HEIGHT + 4096);
+        for (auto &n : noise) {
+            n = static_cast<unsigned char>(random() % 5);
+        }
+
+        std::vector<unsigned char> i420(WIDTH * HEIGHT * 3 / 2, 128);
+        vpx_image_t image;
+        if (nullptr == vpx_img_wrap(&image, VPX_IMG_FMT_I420, WIDTH, HEIGHT, 1, i420.data())) {
+            std::cerr << "[opendlv-video-vpx-encoder]: Failed to wrap frame of " << WIDTH << "x" << HEIGHT << std::endl;
+            return 1;
+        }
+
+        std::cout << "Encoding " << FRAMES << " frames of " << WIDTH << "x" << HEIGHT << " with " << vpx_codec_iface_name(encoderAlgorithm) << " at " << BITRATE << " bps, cpu-used = " << CPUUSED << std::endl;
+        std::cout << "threads  tile columns  row-mt  mean [ms]  95% [ms]  frames/s  speedup  kbps" << std::endl;
+
+        double meanWithOneThread{0};
+        for (uint32_t threads{1}; threads <= MAX_THREADS; threads++) {
+            vpx_codec_enc_cfg_t parameters;
+            memset(&parameters, 0, sizeof(parameters));
+            if (vpx_codec_enc_config_default(encoderAlgorithm, &parameters, 0)) {
+                std::cerr << "[opendlv-video-vpx-encoder]: Failed to get default configuration." << std::endl;
+                return 1;
+            }
+            // As configured by the microservice with its default settings.
+            parameters.g_w = WIDTH;
+            parameters.g_h = HEIGHT;
+            parameters.g_timebase.num = 1;
+            parameters.g_timebase.den = 1000000;
+            parameters.g_threads = threads;
+            parameters.g_lag_in_frames = 0;
+            parameters.rc_end_usage = VPX_CBR;
+            parameters.rc_max_quantizer = (VP8 ? 56 : 52);
+            parameters.rc_target_bitrate = BITRATE / 1000;
+            parameters.kf_mode = vpx_kf_mode::VPX_KF_AUTO;
+            parameters.kf_min_dist = 0;
+            parameters.kf_max_dist = 100;
+
+            VpxEncoder encoder;
+            vpx_codec_err_t result = encoder.init(encoderAlgorithm, parameters);
+            if (result) {
+                std::cerr << "[opendlv-video-vpx-encoder]: Failed to initialize encoder: " << vpx_codec_err_to_string(result) << std::endl;
+                return 1;
+            }
+            vpx_codec_control(encoder.codec(), VP8E_SET_CPUUSED, CPUUSED);
+            const uint32_t LOG2_TILE_COLUMNS{VP8 ? 0 : VpxEncoder::tileColumns(WIDTH, threads)};
+            const uint32_t USE_ROW_MT{(!VP8 && (1 < threads)) ? 1u : 0u};
+            if (!VP8) {
+                vpx_codec_control(encoder.codec(), VP9E_SET_TILE_COLUMNS, static_cast<int>(LOG2_TILE_COLUMNS));
+                vpx_codec_control(encoder.codec(), VP9E_SET_ROW_MT, USE_ROW_MT);
+            }
+
+            EncodedFrame f;
+            std::vector<int64_t> durations;
+            durations.reserve(FRAMES);
+            uint64_t bytes{0};
+            const int64_t FRAME_INTERVAL{33333};
+            for (uint32_t n{0}; n < FRAMES; n++) {
+                const uint32_t PAN_X{(3 * n) % (TEXTURE_WIDTH - WIDTH)};
+                const uint32_t PAN_Y{n % (TEXTURE_HEIGHT - HEIGHT)};
+                for (uint32_t y{0}; y < HEIGHT; y++) {
+                    const unsigned char *src{&texture[(y + PAN_Y) * TEXTURE_WIDTH + PAN_X]};
+                    const unsigned char *sensor{&noise[(n * 61) % 4096 + y * WIDTH]};
+                    unsigned char *dst{&i420[y * WIDTH]};
+                    for (uint32_t x{0}; x < WIDTH; x++) {
+                        dst[x] = static_cast<unsigned char>(src[x] + sensor[x]);
+                    }
+                }
+
+                result = encoder.encode(&image, static_cast<vpx_codec_pts_t>(n) * FRAME_INTERVAL, FRAME_INTERVAL, 0, f, false);
+                if (result) {
+                    std::cerr << "[opendlv-video-vpx-encoder]: Failed to encode frame: " << vpx_codec_err_to_string(result) << std::endl;
+                    return 1;
+                }
+                durations.push_back(f.encodingDuration);
+                bytes += f.size;
+            }
+
+            std::sort(durations.begin(), durations.end());
+            double mean{0};
+            for (auto d : durations) {
+                mean += static_cast<double>(d);
+            }
+            mean /= static_cast<double>(FRAMES) * 1000.0;
+            const double P95{static_cast<double>(durations[(FRAMES * 95) / 100]) / 1000.0};
+            if (1 == threads) {
+                meanWithOneThread = mean;
+            }
+            const double KBPS{static_cast<double>(bytes) * 8.0 / (static_cast<double>(FRAMES) * static_cast<double>(FRAME_INTERVAL) / 1000000.0) / 1000.0};
+
+            char line[128];
+            snprintf(line, sizeof(line), "%7u  %12u  %6u  %9.2f  %8.2f  %8.1f  %7.2f  %4.0f", threads, (1u << LOG2_TILE_COLUMNS), USE_ROW_MT, mean, P95, 1000.0 / mean, meanWithOneThread / mean, KBPS);
+            std::cout << line << std::endl;
+        }
+        vpx_img_free(&image);
+    }
+    return retCode;
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOOPBACK_HPP
+#define LOOPBACK_HPP
+
+#include "cluon-complete.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * This class receives the datagrams sent to a loopback port for the tests.
+ */
+class Loopback {
+   private:
+    Loopback(const Loopback &) = delete;
+    Loopback(Loopback &&)      = delete;
+    Loopback &operator=(const Loopback &) = delete;
+    Loopback &operator=(Loopback &&) = delete;
+
+   public:
+    Loopback() noexcept {
+        m_socket = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        struct sockaddr_in address{};
+        address.sin_family      = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port        = 0;
+        socklen_t length{sizeof(address)};
+        if ((0 <= m_socket)
+            && (0 == ::bind(m_socket, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)))
+            && (0 == ::getsockname(m_socket, reinterpret_cast<struct sockaddr *>(&address), &length))) {
+            m_port = ntohs(address.sin_port);
+            // Never block a test run on a datagram that did not arrive.
+            struct timeval timeout{1, 0};
+            ::setsockopt(m_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        }
+    }
+
+    ~Loopback() {
+        if (0 <= m_socket) {
+            ::close(m_socket);
+        }
+    }
+
+    uint16_t port() const noexcept {
+        return m_port;
+    }
+
+    /**
+     * @param numberOfDatagrams Number of datagrams to receive.
+     * @return Received datagrams in the order they were sent.
+     */
+    std::vector<std::string> datagrams(uint32_t numberOfDatagrams) noexcept {
+        std::vector<std::string> datagrams;
+        std::vector<char> buffer(MAX_DATAGRAM_SIZE);
+        for (uint32_t i{0}; i < numberOfDatagrams; i++) {
+            const ssize_t SIZE{::recv(m_socket, buffer.data(), buffer.size(), 0)};
+            if (0 >= SIZE) {
+                break;
+            }
+            datagrams.emplace_back(buffer.data(), static_cast<std::size_t>(SIZE));
+        }
+        return datagrams;
+    }
+
+    /**
+     * @param numberOfDatagrams Number of datagrams to receive.
+     * @return Envelopes of the received datagrams in the order they were sent.
+     */
+    std::vector<cluon::data::Envelope> receive(uint32_t numberOfDatagrams) noexcept {
+        std::vector<cluon::data::Envelope> envelopes;
+        for (auto &datagram : datagrams(numberOfDatagrams)) {
+            std::stringstream sstr(datagram);
+            envelopes.push_back(cluon::extractEnvelope(sstr).second);
+        }
+        return envelopes;
+    }
+
+   private:
+    static constexpr uint32_t MAX_DATAGRAM_SIZE{65535};
+
+    int m_socket{-1};
+    uint16_t m_port{0};
+};
+
+#endif
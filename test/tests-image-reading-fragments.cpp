@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define CATCH_CONFIG_MAIN // This tells Catch to provide a main() - only do this in one cpp file.
+#include "catch.hpp"
+
+#include "cluon-complete.hpp"
+#include "opendlv-standard-message-set.hpp"
+#include "opendlv-video-message-set.hpp"
+#include "image-reading-fragments.hpp"
+#include "loopback.hpp"
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+const uint32_t MAX_DATAGRAM_SIZE{1400};
+const uint32_t FRAGMENT_SIZE{MAX_DATAGRAM_SIZE - Fragmenter::OVERHEAD};
+
+// Returns an ImageReading with the given amount of pseudo-random data.
+opendlv::proxy::ImageReading makeFrame(std::mt19937 &random, uint32_t size) noexcept {
+    std::string data(size, '\0');
+    for (auto &c : data) {
+        c = static_cast<char>(random());
+    }
+    opendlv::proxy::ImageReading ir;
+    ir.fourcc("VP80").width(640).height(480).data(data);
+    return ir;
+}
+
+std::string serialize(opendlv::proxy::ImageReading &ir) noexcept {
+    cluon::ToProtoVisitor protoEncoder;
+    ir.accept(protoEncoder);
+    return protoEncoder.encodedData();
+}
+
+// Sends the ImageReading as fragments and returns the received datagrams.
+std::vector<cluon::data::Envelope> fragment(Fragmenter &fragmenter, EnvelopeSender &sender, Loopback &loopback, const std::string &message, int32_t seconds, uint32_t groupSize) noexcept {
+    struct iovec part;
+    part.iov_base = const_cast<char *>(message.data());
+    part.iov_len  = message.size();
+    cluon::data::TimeStamp sampleTimeStamp;
+    sampleTimeStamp.seconds(seconds);
+    const uint32_t DATAGRAMS{fragmenter.send(sender, opendlv::proxy::ImageReading::ID(), &part, 1, sampleTimeStamp, 0, nullptr, groupSize)};
+    return loopback.receive(DATAGRAMS);
+}
+
+// Passes the datagrams except for the lost ones to the Reassembler.
+bool reassemble(Reassembler &reassembler, std::vector<cluon::data::Envelope> &datagrams, const std::vector<bool> &lost, const std::string &message) {
+    bool retVal{false};
+    for (std::size_t i{0}; i < datagrams.size(); i++) {
+        if (!lost[i]) {
+            auto result = reassembler.process(std::move(datagrams[i]));
+            if (result.first) {
+                REQUIRE(opendlv::proxy::ImageReading::ID() == result.second.dataType());
+                REQUIRE(message == result.second.serializedData());
+                retVal = true;
+            }
+        }
+    }
+    return retVal;
+}
+
+} // namespace
+
+TEST_CASE("Test Fragmenter and Reassembler without loss.") {
+    Loopback loopback;
+    REQUIRE(0 < loopback.port());
+    EnvelopeSender sender{"127.0.0.1", loopback.port()};
+    Fragmenter fragmenter{MAX_DATAGRAM_SIZE};
+    Reassembler reassembler;
+    std::mt19937 random{1};
+
+    for (uint32_t groupSize : {0u, 4u}) {
+        auto ir = makeFrame(random, 20000);
+        const std::string MESSAGE{serialize(ir)};
+        const uint32_t NUMBER_OF_FRAGMENTS{static_cast<uint32_t>((MESSAGE.size() + FRAGMENT_SIZE - 1) / FRAGMENT_SIZE)};
+        const uint32_t NUMBER_OF_PARITY_FRAGMENTS{(0 < groupSize) ? (NUMBER_OF_FRAGMENTS + groupSize - 1) / groupSize : 0};
+
+        auto datagrams = fragment(fragmenter, sender, loopback, MESSAGE, 1, groupSize);
+        REQUIRE(NUMBER_OF_FRAGMENTS + NUMBER_OF_PARITY_FRAGMENTS == datagrams.size());
+        REQUIRE(reassemble(reassembler, datagrams, std::vector<bool>(datagrams.size(), false), MESSAGE));
+    }
+    REQUIRE(2 == reassembler.framesReassembled());
+    REQUIRE(0 == reassembler.fragmentsRecovered());
+}
+
+TEST_CASE("Test Reassembler restoring a burst of lost fragments from the interleaved parity.") {
+    Loopback loopback;
+    REQUIRE(0 < loopback.port());
+    EnvelopeSender sender{"127.0.0.1", loopback.port()};
+    Fragmenter fragmenter{MAX_DATAGRAM_SIZE};
+    std::mt19937 random{2};
+
+    const uint32_t GROUP_SIZE{4};
+    auto ir = makeFrame(random, 50000);
+    const std::string MESSAGE{serialize(ir)};
+    const uint32_t NUMBER_OF_FRAGMENTS{static_cast<uint32_t>((MESSAGE.size() + FRAGMENT_SIZE - 1) / FRAGMENT_SIZE)};
+    const uint32_t NUMBER_OF_GROUPS{(NUMBER_OF_FRAGMENTS + GROUP_SIZE - 1) / GROUP_SIZE};
+
+    // Every burst of NUMBER_OF_GROUPS consecutive fragments hits every group once.
+    for (uint32_t first{0}; first + NUMBER_OF_GROUPS <= NUMBER_OF_FRAGMENTS; first++) {
+        Reassembler reassembler;
+        auto datagrams = fragment(fragmenter, sender, loopback, MESSAGE, 1, GROUP_SIZE);
+        REQUIRE(NUMBER_OF_FRAGMENTS + NUMBER_OF_GROUPS == datagrams.size());
+
+        std::vector<bool> lost(datagrams.size(), false);
+        for (uint32_t i{first}; i < first + NUMBER_OF_GROUPS; i++) {
+            lost[i] = true;
+        }
+        REQUIRE(reassemble(reassembler, datagrams, lost, MESSAGE));
+        REQUIRE(NUMBER_OF_GROUPS == reassembler.fragmentsRecovered());
+        REQUIRE(1 == reassembler.framesRecovered());
+    }
+
+    // One more lost fragment leaves a group with two missing fragments.
+    {
+        Reassembler reassembler;
+        auto datagrams = fragment(fragmenter, sender, loopback, MESSAGE, 1, GROUP_SIZE);
+        std::vector<bool> lost(datagrams.size(), false);
+        for (uint32_t i{0}; i <= NUMBER_OF_GROUPS; i++) {
+            lost[i] = true;
+        }
+        REQUIRE(!reassemble(reassembler, datagrams, lost, MESSAGE));
+        REQUIRE(0 == reassembler.framesReassembled());
+    }
+
+    // Lost parity fragments do not matter when all fragments arrived.
+    {
+        Reassembler reassembler;
+        auto datagrams = fragment(fragmenter, sender, loopback, MESSAGE, 1, GROUP_SIZE);
+        std::vector<bool> lost(datagrams.size(), false);
+        for (uint32_t i{NUMBER_OF_FRAGMENTS}; i < datagrams.size(); i++) {
+            lost[i] = true;
+        }
+        REQUIRE(reassemble(reassembler, datagrams, lost, MESSAGE));
+        REQUIRE(0 == reassembler.fragmentsRecovered());
+    }
+}
+
+TEST_CASE("Test Reassembler after the sender was restarted.") {
+    Loopback loopback;
+    REQUIRE(0 < loopback.port());
+    EnvelopeSender sender{"127.0.0.1", loopback.port()};
+    Reassembler reassembler;
+    std::mt19937 random{5};
+
+    {
+        Fragmenter fragmenter{MAX_DATAGRAM_SIZE};
+        for (uint32_t n{0}; n < 100; n++) {
+            auto ir = makeFrame(random, 5000);
+            const std::string MESSAGE{serialize(ir)};
+            auto datagrams = fragment(fragmenter, sender, loopback, MESSAGE, 1, 0);
+            REQUIRE(reassemble(reassembler, datagrams, std::vector<bool>(datagrams.size(), false), MESSAGE));
+        }
+    }
+
+    // The restarted sender counts its frames from 0 again.
+    Fragmenter fragmenter{MAX_DATAGRAM_SIZE};
+    for (uint32_t n{0}; n < 10; n++) {
+        auto ir = makeFrame(random, 5000);
+        const std::string MESSAGE{serialize(ir)};
+        auto datagrams = fragment(fragmenter, sender, loopback, MESSAGE, 2, 4);
+        REQUIRE(reassemble(reassembler, datagrams, std::vector<bool>(datagrams.size(), false), MESSAGE));
+    }
+    REQUIRE(110 == reassembler.framesReassembled());
+    REQUIRE(0 == reassembler.framesLost());
+}
+
+TEST_CASE("Test Reassembler rejecting inconsistent fragments.") {
+    Loopback loopback;
+    REQUIRE(0 < loopback.port());
+    EnvelopeSender sender{"127.0.0.1", loopback.port()};
+    Fragmenter fragmenter{MAX_DATAGRAM_SIZE};
+    Reassembler reassembler{1024 * 1024};
+    std::mt19937 random{6};
+
+    auto envelopeOf = [](opendlv::video::ImageReadingFragment &f) {
+        cluon::ToProtoVisitor protoEncoder;
+        f.accept(protoEncoder);
+        cluon::data::Envelope envelope;
+        envelope.dataType(opendlv::video::ImageReadingFragment::ID()).serializedData(protoEncoder.encodedData());
+        return envelope;
+    };
+    const std::string DATA(FRAGMENT_SIZE, 'x');
+
+    // Sizes that do not match the fragment's data or exceed the largest message.
+    opendlv::video::ImageReadingFragment f;
+    f.frameIdentifier(7).fragmentIndex(0).numberOfFragments(2).dataType(opendlv::proxy::ImageReading::ID()).offset(0).size(0xFFFFFFFF).data(DATA);
+    REQUIRE(!reassembler.process(envelopeOf(f)).first);
+    f.numberOfFragments(0xFFFF).size(0xFFFF * FRAGMENT_SIZE);
+    REQUIRE(!reassembler.process(envelopeOf(f)).first);
+    f.numberOfFragments(2).size(FRAGMENT_SIZE + 1).numberOfParityFragments(3);
+    REQUIRE(!reassembler.process(envelopeOf(f)).first);
+    f.numberOfParityFragments(0).fragmentIndex(1).offset(0xFFFFFF00).size(FRAGMENT_SIZE + 1);
+    REQUIRE(!reassembler.process(envelopeOf(f)).first);
+    REQUIRE(4 == reassembler.fragmentsRejected());
+
+    // A fragment that disagrees with the first fragment of its message is ignored.
+    auto ir = makeFrame(random, 20000);
+    const std::string MESSAGE{serialize(ir)};
+    auto datagrams = fragment(fragmenter, sender, loopback, MESSAGE, 1, 4);
+    REQUIRE(!reassembler.process(cluon::data::Envelope(datagrams[0])).first);
+    auto first = cluon::extractMessage<opendlv::video::ImageReadingFragment>(cluon::data::Envelope(datagrams[1]));
+    first.numberOfParityFragments(static_cast<uint16_t>(first.numberOfParityFragments() + 1));
+    REQUIRE(!reassembler.process(envelopeOf(first)).first);
+    first.numberOfParityFragments(static_cast<uint16_t>(first.numberOfParityFragments() - 1)).size(first.size() + 1);
+    REQUIRE(!reassembler.process(envelopeOf(first)).first);
+    REQUIRE(6 == reassembler.fragmentsRejected());
+
+    std::vector<bool> lost(datagrams.size(), false);
+    lost[0] = true;
+    REQUIRE(reassemble(reassembler, datagrams, lost, MESSAGE));
+    REQUIRE(0 == reassembler.fragmentsRecovered());
+}
+
+TEST_CASE("Test forward error correction with random and bursty loss.") {
+    Loopback loopback;
+    REQUIRE(0 < loopback.port());
+    EnvelopeSender sender{"127.0.0.1", loopback.port()};
+
+    const uint32_t FRAMES{300};
+    const double LOSS{0.02};
+    // Bursts of lost datagrams with a mean length of 4 (Gilbert model).
+    const double END_OF_BURST{0.25};
+
+    for (bool bursty : {false, true}) {
+        uint32_t framesReceived[2]{0, 0};
+        for (uint32_t groupSize : {0u, 4u}) {
+            Fragmenter fragmenter{MAX_DATAGRAM_SIZE};
+            Reassembler reassembler;
+            // The same frames and loss pattern for both runs.
+            std::mt19937 random{3};
+            std::mt19937 loss{4};
+            std::uniform_real_distribution<double> uniform{0.0, 1.0};
+            bool inBurst{false};
+
+            for (uint32_t n{0}; n < FRAMES; n++) {
+                auto ir = makeFrame(random, 60000 + (n % 7) * 100);
+                const std::string MESSAGE{serialize(ir)};
+                auto datagrams = fragment(fragmenter, sender, loopback, MESSAGE, static_cast<int32_t>(n + 1), groupSize);
+                REQUIRE(0 < datagrams.size());
+
+                std::vector<bool> lost(datagrams.size(), false);
+                for (std::size_t i{0}; i < datagrams.size(); i++) {
+                    if (bursty) {
+                        inBurst = inBurst ? (uniform(loss) > END_OF_BURST) : (uniform(loss) < LOSS * END_OF_BURST / (1.0 - LOSS));
+                        lost[i] = inBurst;
+                    }
+                    else {
+                        lost[i] = (uniform(loss) < LOSS);
+                    }
+                }
+                framesReceived[(0 < groupSize) ? 1 : 0] += reassemble(reassembler, datagrams, lost, MESSAGE) ? 1 : 0;
+            }
+
+            if (0 < groupSize) {
+                REQUIRE(0 < reassembler.framesRecovered());
+            }
+            else {
+                REQUIRE(0 == reassembler.framesRecovered());
+            }
+        }
+
+        INFO("bursty loss: " << bursty << ", frames received without FEC: " << framesReceived[0] << ", with FEC: " << framesReceived[1]);
+        CHECK(framesReceived[0] + FRAMES / 10 < framesReceived[1]);
+        CHECK(FRAMES * 9 / 10 <= framesReceived[1]);
+    }
+}
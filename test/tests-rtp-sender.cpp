@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "catch.hpp"
+
+#include "loopback.hpp"
+#include "rtp-sender.hpp"
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+const uint32_t MTU{1200};
+const uint8_t PAYLOAD_TYPE{96};
+const int64_t FRAME_INTERVAL{100000};  // 9000 ticks at 90 kHz.
+
+// RTP header (RFC 3550) and payload descriptor of VP8 (RFC 7741) or VP9 (RFC 9628).
+struct Packet {
+    uint32_t size{0};
+    uint8_t version{0};
+    bool marker{false};
+    uint8_t payloadType{0};
+    uint16_t sequenceNumber{0};
+    uint32_t timeStamp{0};
+    uint32_t ssrc{0};
+
+    bool start{false};  // VP8: S, VP9: B.
+    bool end{false};    // VP9: E.
+    bool predicted{false};  // VP9: P.
+    bool hasPictureId{false};
+    uint16_t pictureId{0};
+    bool hasLayerIndices{false};
+    uint8_t temporalLayer{0};
+    uint8_t spatialLayer{0};
+    bool interLayerDependency{false};
+    uint8_t tl0PicIdx{0};
+    bool hasScalabilityStructure{false};
+    std::vector<std::pair<uint32_t, uint32_t> > spatialSizes{};
+    std::string payload{};
+};
+
+Packet parse(const std::string &datagram, bool vp8) {
+    const uint8_t *d{reinterpret_cast<const uint8_t *>(datagram.data())};
+    Packet p;
+    p.size = static_cast<uint32_t>(datagram.size());
+    REQUIRE(12 < datagram.size());
+    p.version = static_cast<uint8_t>(d[0] >> 6);
+    REQUIRE(0 == (d[0] & 0x3F));  // No padding, extension, or CSRCs.
+    p.marker = (0 != (d[1] & 0x80));
+    p.payloadType = static_cast<uint8_t>(d[1] & 0x7F);
+    p.sequenceNumber = static_cast<uint16_t>((d[2] << 8) | d[3]);
+    p.timeStamp = (static_cast<uint32_t>(d[4]) << 24) | (static_cast<uint32_t>(d[5]) << 16) | (static_cast<uint32_t>(d[6]) << 8) | d[7];
+    p.ssrc = (static_cast<uint32_t>(d[8]) << 24) | (static_cast<uint32_t>(d[9]) << 16) | (static_cast<uint32_t>(d[10]) << 8) | d[11];
+
+    uint32_t i{12};
+    auto next = [&datagram, &d, &i]() {
+        REQUIRE(i < datagram.size());
+        return d[i++];
+    };
+    auto readPictureId = [&p, &next]() {
+        const uint8_t FIRST{next()};
+        p.hasPictureId = true;
+        p.pictureId = (0 != (FIRST & 0x80)) ? static_cast<uint16_t>(((FIRST & 0x7F) << 8) | next()) : static_cast<uint16_t>(FIRST & 0x7F);
+    };
+    if (vp8) {
+        const uint8_t FIRST{next()};
+        p.start = (0 != (FIRST & 0x10));
+        REQUIRE(0 == (FIRST & 0x07));  // Partition 0.
+        if (0 != (FIRST & 0x80)) {
+            const uint8_t EXTENSION{next()};
+            if (0 != (EXTENSION & 0x80)) {
+                readPictureId();
+            }
+            if (0 != (EXTENSION & 0x40)) {
+                p.hasLayerIndices = true;
+                p.tl0PicIdx = next();
+            }
+            if (0 != (EXTENSION & 0x30)) {
+                p.temporalLayer = static_cast<uint8_t>(next() >> 6);
+            }
+        }
+    }
+    else {
+        const uint8_t FIRST{next()};
+        p.predicted = (0 != (FIRST & 0x40));
+        REQUIRE(0 == (FIRST & 0x10));  // Non-flexible mode.
+        p.start = (0 != (FIRST & 0x08));
+        p.end = (0 != (FIRST & 0x04));
+        if (0 != (FIRST & 0x80)) {
+            readPictureId();
+        }
+        if (0 != (FIRST & 0x20)) {
+            const uint8_t LAYERS{next()};
+            p.hasLayerIndices = true;
+            p.temporalLayer = static_cast<uint8_t>(LAYERS >> 5);
+            p.spatialLayer = static_cast<uint8_t>((LAYERS >> 1) & 0x07);
+            p.interLayerDependency = (0 != (LAYERS & 0x01));
+            p.tl0PicIdx = next();
+        }
+        if (0 != (FIRST & 0x02)) {
+            const uint8_t SS{next()};
+            p.hasScalabilityStructure = true;
+            REQUIRE(0 != (SS & 0x10));  // Y: sizes follow.
+            REQUIRE(0 == (SS & 0x08));  // G: no picture group.
+            for (uint32_t s{0}; s <= static_cast<uint32_t>(SS >> 5); s++) {
+                const uint32_t WIDTH{static_cast<uint32_t>(next() << 8)};
+                const uint32_t W{WIDTH | next()};
+                const uint32_t HEIGHT{static_cast<uint32_t>(next() << 8)};
+                p.spatialSizes.emplace_back(W, HEIGHT | next());
+            }
+        }
+    }
+    p.payload = datagram.substr(i);
+    return p;
+}
+
+std::string makeFrame(std::mt19937 &random, uint32_t size) noexcept {
+    std::string data(size, '\0');
+    for (auto &c : data) {
+        c = static_cast<char>(random());
+    }
+    return data;
+}
+
+// Sends the frame and returns the parsed packets after checking what is common to all of them.
+std::vector<Packet> send(RtpSender &rtp, Loopback &loopback, bool vp8, const std::string &data, const RtpSender::Frame &frame) {
+    const uint32_t PACKETS{rtp.send(data.data(), static_cast<uint32_t>(data.size()), frame)};
+    REQUIRE((data.size() + MTU - 1) / MTU <= PACKETS);
+    auto datagrams = loopback.datagrams(PACKETS);
+    REQUIRE(PACKETS == datagrams.size());
+
+    std::vector<Packet> packets;
+    std::string payload;
+    for (std::size_t i{0}; i < datagrams.size(); i++) {
+        packets.push_back(parse(datagrams[i], vp8));
+        const Packet &p{packets.back()};
+        REQUIRE(MTU >= p.size);
+        REQUIRE(2 == p.version);
+        REQUIRE(PAYLOAD_TYPE == p.payloadType);
+        REQUIRE(rtp.ssrc() == p.ssrc);
+        REQUIRE(p.hasPictureId);
+        REQUIRE((0 == i) == p.start);
+        if (!vp8) {
+            REQUIRE((i + 1 == datagrams.size()) == p.end);
+            REQUIRE(frame.keyFrame != p.predicted);
+        }
+        if (0 < i) {
+            REQUIRE(static_cast<uint16_t>(packets[i - 1].sequenceNumber + 1) == p.sequenceNumber);
+            REQUIRE(packets[0].timeStamp == p.timeStamp);
+            REQUIRE(packets[0].pictureId == p.pictureId);
+            REQUIRE(!p.hasScalabilityStructure);
+            REQUIRE(!packets[i - 1].marker);
+        }
+        payload += p.payload;
+    }
+    REQUIRE(data == payload);
+    // The marker bit ends a picture, i.e., its highest spatial layer.
+    REQUIRE((vp8 || frame.endOfPicture) == packets.back().marker);
+    return packets;
+}
+
+} // namespace
+
+TEST_CASE("Test RtpSender with VP8.") {
+    Loopback loopback;
+    REQUIRE(0 < loopback.port());
+    RtpSender rtp{"127.0.0.1", loopback.port(), true, PAYLOAD_TYPE, MTU, {{640, 480}}, 1};
+    REQUIRE(rtp.valid());
+    std::mt19937 random{1};
+
+    Packet previous;
+    for (uint32_t n{0}; n < 10; n++) {
+        RtpSender::Frame frame;
+        frame.sampleTimeStamp = static_cast<int64_t>(n) * FRAME_INTERVAL;
+        frame.keyFrame = (0 == n % 5);
+        // The inverse key frame flag P of the VP8 payload header follows the payload descriptor.
+        std::string data{makeFrame(random, frame.keyFrame ? 20000 : 3000)};
+        data[0] = static_cast<char>(frame.keyFrame ? (data[0] & ~0x01) : (data[0] | 0x01));
+        auto packets = send(rtp, loopback, true, data, frame);
+        REQUIRE(frame.keyFrame == (0 == (packets.front().payload[0] & 0x01)));
+        for (auto &p : packets) {
+            REQUIRE(!p.hasLayerIndices);
+        }
+        if (0 < n) {
+            REQUIRE(static_cast<uint16_t>(previous.sequenceNumber + 1) == packets.front().sequenceNumber);
+            REQUIRE(previous.timeStamp + 9000 == packets.front().timeStamp);
+            REQUIRE(((previous.pictureId + 1) & 0x7FFF) == packets.front().pictureId);
+        }
+        previous = packets.back();
+    }
+    REQUIRE(0 < rtp.packetsSent());
+}
+
+TEST_CASE("Test RtpSender with VP8 and temporal layers.") {
+    Loopback loopback;
+    REQUIRE(0 < loopback.port());
+    RtpSender rtp{"127.0.0.1", loopback.port(), true, PAYLOAD_TYPE, MTU, {{640, 480}}, 2};
+    std::mt19937 random{2};
+
+    Packet previous;
+    for (uint32_t n{0}; n < 8; n++) {
+        RtpSender::Frame frame;
+        frame.sampleTimeStamp = static_cast<int64_t>(n) * FRAME_INTERVAL;
+        frame.keyFrame = (0 == n);
+        frame.temporalLayer = n % 2;
+        auto packets = send(rtp, loopback, true, makeFrame(random, 5000), frame);
+        for (auto &p : packets) {
+            REQUIRE(p.hasLayerIndices);
+            REQUIRE(frame.temporalLayer == p.temporalLayer);
+            REQUIRE(packets.front().tl0PicIdx == p.tl0PicIdx);
+        }
+        if (0 < n) {
+            REQUIRE(((previous.pictureId + 1) & 0x7FFF) == packets.front().pictureId);
+            // TL0PICIDX counts the frames of the base layer.
+            REQUIRE(static_cast<uint8_t>(previous.tl0PicIdx + ((0 == frame.temporalLayer) ? 1 : 0)) == packets.front().tl0PicIdx);
+        }
+        previous = packets.back();
+    }
+}
+
+TEST_CASE("Test RtpSender with VP9 and spatial and temporal layers.") {
+    Loopback loopback;
+    REQUIRE(0 < loopback.port());
+    const std::vector<std::pair<uint32_t, uint32_t> > SPATIAL_SIZES{{320, 240}, {640, 480}};
+    RtpSender rtp{"127.0.0.1", loopback.port(), false, PAYLOAD_TYPE, MTU, SPATIAL_SIZES, 2};
+    std::mt19937 random{3};
+
+    Packet previous;
+    for (uint32_t n{0}; n < 8; n++) {
+        for (uint32_t s{0}; s < SPATIAL_SIZES.size(); s++) {
+            RtpSender::Frame frame;
+            frame.sampleTimeStamp = static_cast<int64_t>(n) * FRAME_INTERVAL;
+            frame.keyFrame = (0 == n % 4);
+            frame.spatialLayer = s;
+            frame.temporalLayer = n % 2;
+            frame.endOfPicture = (s + 1 == SPATIAL_SIZES.size());
+            auto packets = send(rtp, loopback, false, makeFrame(random, frame.keyFrame ? 12000 : 4000), frame);
+            for (auto &p : packets) {
+                REQUIRE(p.hasLayerIndices);
+                REQUIRE(frame.temporalLayer == p.temporalLayer);
+                REQUIRE(s == p.spatialLayer);
+                REQUIRE((0 < s) == p.interLayerDependency);
+            }
+
+            // Keyframes describe all spatial layers in the first packet of the lowest one.
+            const bool SS{frame.keyFrame && (0 == s)};
+            REQUIRE(SS == packets.front().hasScalabilityStructure);
+            if (SS) {
+                REQUIRE(SPATIAL_SIZES == packets.front().spatialSizes);
+            }
+
+            if (0 < s) {
+                // All spatial layers of a picture share time stamp, picture ID, and TL0PICIDX.
+                REQUIRE(previous.timeStamp == packets.front().timeStamp);
+                REQUIRE(previous.pictureId == packets.front().pictureId);
+                REQUIRE(previous.tl0PicIdx == packets.front().tl0PicIdx);
+            }
+            else if (0 < n) {
+                REQUIRE(previous.timeStamp + 9000 == packets.front().timeStamp);
+                REQUIRE(((previous.pictureId + 1) & 0x7FFF) == packets.front().pictureId);
+                REQUIRE(static_cast<uint8_t>(previous.tl0PicIdx + ((0 == frame.temporalLayer) ? 1 : 0)) == packets.front().tl0PicIdx);
+            }
+            if ((0 < n) || (0 < s)) {
+                REQUIRE(static_cast<uint16_t>(previous.sequenceNumber + 1) == packets.front().sequenceNumber);
+            }
+            previous = packets.back();
+        }
+    }
+}
+
+TEST_CASE("Test RtpSender keeping every packet within the MTU.") {
+    Loopback loopback;
+    REQUIRE(0 < loopback.port());
+    std::mt19937 random{4};
+
+    // The first packet of a VP9 keyframe carries the scalability structure on top.
+    for (bool vp8 : {true, false}) {
+        RtpSender rtp{"127.0.0.1", loopback.port(), vp8, PAYLOAD_TYPE, MTU, {{320, 240}, {640, 480}, {1280, 960}}, 3};
+        for (uint32_t size : {1u, MTU - 20, MTU - 10, MTU, MTU + 1, 2 * MTU, 50000u}) {
+            RtpSender::Frame frame;
+            frame.keyFrame = true;
+            frame.endOfPicture = false;
+            send(rtp, loopback, vp8, makeFrame(random, size), frame);
+        }
+    }
+}
@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "catch.hpp"
+
+#include "cluon-complete.hpp"
+#include "opendlv-video-message-set.hpp"
+#include "container-writer.hpp"
+#include "duplicate-frame-detector.hpp"
+#include "encoded-frame.hpp"
+#include "encoded-frame-ring.hpp"
+#include "envelope-sender.hpp"
+#include "file-writer.hpp"
+#include "frame-capture.hpp"
+#include "frame-transform.hpp"
+#include "layer.hpp"
+#include "layer-encoder.hpp"
+#include "pacer.hpp"
+#include "publisher.hpp"
+#include "rtp-sender.hpp"
+#include "source.hpp"
+#include "static-scene-detector.hpp"
+
+#include "loopback.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Every allocation through operator new in this test runner is counted.
+static std::atomic<uint64_t> numberOfAllocations{0};
+
+void *operator new(std::size_t size) {
+    numberOfAllocations++;
+    void *p{std::malloc((0 < size) ? size : 1)};
+    if (nullptr == p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+    numberOfAllocations++;
+    return std::malloc((0 < size) ? size : 1);
+}
+
+// Not inlined, so that the compiler does not pair free() with operator new.
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    ::operator delete(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+    ::operator delete(p);
+}
+
+namespace {
+
+const uint32_t WIDTH{640};
+const uint32_t HEIGHT{480};
+const uint32_t WARM_UP_FRAMES{10};
+const uint32_t FRAMES{100};
+const int64_t FRAME_INTERVAL{33333};
+
+/**
+ * This function captures frames from a shared memory area, encodes them, and
+ * publishes them to all outputs (OD4Session with FEC, ring, recording, IVF and
+ * WebM archives, and paced RTP) through the classes of the microservice. Without
+ * threads, one layer is encoded from the shared memory as in the sequential loop
+ * of Pipeline. With threads, the frames are copied out and encoded for a full
+ * and a downscaled layer; the steps of the capture thread, a worker, and the
+ * publishing thread are run one after another in the calling thread and hand
+ * the frames over through the queues of the layers as in the threaded loop.
+ *
+ * @param vp8 True for VP8, false for VP9.
+ * @param threaded True for the threaded pipeline.
+ * @return Number of allocations for all frames after warming up.
+ */
+uint64_t allocations(bool vp8, bool threaded) {
+    const std::string NAME{std::string{"tests-vpx-encoder-"} + (vp8 ? "vp8" : "vp9") + (threaded ? "-threaded" : "")};
+    const uint32_t POOL_SIZE{threaded ? 3u : 1u};
+    const bool COPY{threaded};
+
+    // The shared memory area of the producer must exist before the source attaches to it.
+    cluon::SharedMemory producer{NAME, WIDTH * HEIGHT * 3 / 2};
+    REQUIRE(producer.valid());
+
+    std::vector<std::unique_ptr<Source> > sources;
+    sources.emplace_back(new Source{NAME, WIDTH, HEIGHT, "i420", 0, 0, FrameTransform::Geometry{}, (COPY ? POOL_SIZE : 0u)});
+    Source &source{*sources[0]};
+    REQUIRE(source.sharedMemory->valid());
+    if (!COPY) {
+        REQUIRE(source.input.wrap(source.sharedMemory->data(), &source.yuvFrame));
+    }
+    source.detector.reset(new StaticSceneDetector{source.width, source.height, 0.01});
+    source.duplicates.reset(new DuplicateFrameDetector{false});
+
+    Loopback loopback;
+    REQUIRE(0 < loopback.port());
+    EnvelopeSender sender{"127.0.0.1", loopback.port()};
+
+    LayerEncoder::Settings encoderSettings;
+    encoderSettings.gop = 25;
+    encoderSettings.cpuUsed = (vp8 ? 8 : 7);
+    LayerEncoder layerEncoder{encoderSettings, nullptr};
+
+    std::vector<std::unique_ptr<Layer> > layers;
+    const uint32_t NUMBER_OF_LAYERS{threaded ? 2u : 1u};
+    for (uint32_t i{0}; i < NUMBER_OF_LAYERS; i++) {
+        const uint32_t W{WIDTH >> i};
+        const uint32_t H{HEIGHT >> i};
+        std::unique_ptr<Layer> layer{new Layer(W, H, 800000 >> i, vp8, i, 1, 1, (0 < i), POOL_SIZE, Fragmenter::MAX_DATAGRAM_SIZE)};
+        layer->filter = source.transform.filter();
+        source.numberOfLayers++;
+        REQUIRE(layerEncoder.open(*layer));
+
+        const uint32_t MAX_FRAME_SIZE{static_cast<uint32_t>(layer->encodedFrames[0].data.size())};
+        layer->ivf.reset(new IvfWriter{NAME + "-" + std::to_string(i) + ".ivf", vp8, W, H, MAX_FRAME_SIZE});
+        layer->webm.reset(new WebmWriter{NAME + "-" + std::to_string(i) + ".webm", vp8, W, H, MAX_FRAME_SIZE});
+        REQUIRE(layer->ivf->valid());
+        REQUIRE(layer->webm->valid());
+        layer->pacer.reset(new Pacer{0.05});
+        std::vector<std::pair<uint32_t, uint32_t> > spatialSizes{std::make_pair(W, H)};
+        layer->rtp.reset(new RtpSender{"127.0.0.1", loopback.port(), vp8, 96, 1200, spatialSizes, 1});
+        REQUIRE(layer->rtp->valid());
+        layers.push_back(std::move(layer));
+    }
+
+    const uint32_t MAX_FRAME_SIZE{static_cast<uint32_t>(layers[0]->encodedFrames[0].data.size())};
+    EncodedFrameRing ring{NAME + "-ring", 4, MAX_FRAME_SIZE};
+    REQUIRE(ring.valid());
+    FileWriter recorder{NAME + ".rec", 4 * 1024 * 1024, 8, 0, std::chrono::seconds(0)};
+    REQUIRE(recorder.valid());
+
+    FrameCapture::Settings captureSettings;
+    captureSettings.copy = COPY;
+    FrameCapture capture{captureSettings, sources, nullptr};
+
+    Publisher::Settings publisherSettings;
+    publisherSettings.fec = 4;
+    publisherSettings.fecKeyFrame = 2;
+    Publisher publisher{publisherSettings, sender, layers, &ring, &recorder};
+
+    uint64_t before{0};
+    uint32_t publishedFrames{0};
+    const int64_t START{cluon::time::toMicroseconds(cluon::time::now())};
+    CapturedFrame c;
+    uint32_t index{0};
+    for (uint32_t n{0}; n < WARM_UP_FRAMES + FRAMES; n++) {
+        // A moving pattern keeps the encoder busy.
+        producer.lock();
+        unsigned char *data{reinterpret_cast<unsigned char *>(producer.data())};
+        for (uint32_t y{0}; y < HEIGHT; y++) {
+            for (uint32_t x{0}; x < WIDTH; x++) {
+                data[y * WIDTH + x] = static_cast<unsigned char>(((x + 4 * n) ^ y) & 0xff);
+            }
+        }
+        producer.setTimeStamp(cluon::time::fromMicroseconds(START + n * FRAME_INTERVAL));
+        producer.unlock();
+
+        if (WARM_UP_FRAMES == n) {
+            before = numberOfAllocations.load();
+        }
+        const uint32_t PUBLISHED{publishedFrames};
+        if (!threaded) {
+            Layer &layer{*layers[0]};
+            EncodedFrame &out{layer.encodedFrames[0]};
+            REQUIRE(capture.capture(source, c));
+            const bool ENCODED{layerEncoder.encode(layer, &source.yuvFrame, c.sampleTimeStamp, c.unchanged, out, false)};
+            source.sharedMemory->unlock();
+            if (ENCODED) {
+                out.sampleTimeStamp = c.sampleTimeStamp;
+                out.lockDuration = cluon::time::deltaInMicroseconds(c.unlocked, c.locked);
+                publisher.publish(layer, out);
+                publishedFrames++;
+            }
+        }
+        else {
+            // Capture thread.
+            REQUIRE(source.framePool.acquire(c.index, source.numberOfLayers));
+            REQUIRE(capture.capture(source, c));
+            for (auto &layer : layers) {
+                REQUIRE(layer->capturedFrames.push(c));
+            }
+
+            // Worker.
+            for (auto &layer : layers) {
+                REQUIRE(layer->freeEncodedFrames.pop(layer->encodedFrameIndex));
+                REQUIRE(layer->capturedFrames.pop(c));
+                EncodedFrame &out{layer->encodedFrames[layer->encodedFrameIndex]};
+                if (layerEncoder.encode(*layer, source.framePool.frame(c.index), c.sampleTimeStamp, c.unchanged, out, true)) {
+                    out.sampleTimeStamp = c.sampleTimeStamp;
+                    out.lockDuration = cluon::time::deltaInMicroseconds(c.unlocked, c.locked);
+                    REQUIRE(layer->encodedFrameQueue.push(layer->encodedFrameIndex));
+                }
+                else {
+                    REQUIRE(layer->freeEncodedFrames.push(layer->encodedFrameIndex));
+                }
+                source.framePool.release(c.index);
+            }
+
+            // Publishing thread.
+            for (auto &layer : layers) {
+                if (layer->encodedFrameQueue.pop(index)) {
+                    publisher.publish(*layer, layer->encodedFrames[index]);
+                    REQUIRE(layer->freeEncodedFrames.push(index));
+                    publishedFrames++;
+                }
+            }
+        }
+        if (PUBLISHED == publishedFrames) {
+            publisher.flushOld();
+        }
+    }
+    // Hand the remaining buffers to the threads writing the recording and the archives as when the streams stop.
+    recorder.flushOld();
+    for (auto &layer : layers) {
+        layer->ivf->flushOld();
+        layer->webm->flushOld();
+    }
+    const uint64_t AFTER{numberOfAllocations.load()};
+
+    REQUIRE(NUMBER_OF_LAYERS * FRAMES / 2 < publishedFrames);
+    REQUIRE(0 == recorder.recordsDropped());
+
+    for (auto &layer : layers) {
+        layer->ivf.reset();
+        layer->webm.reset();
+    }
+    std::remove((NAME + ".rec").c_str());
+    for (uint32_t i{0}; i < NUMBER_OF_LAYERS; i++) {
+        std::remove((NAME + "-" + std::to_string(i) + ".ivf").c_str());
+        std::remove((NAME + "-" + std::to_string(i) + ".webm").c_str());
+    }
+    return AFTER - before;
+}
+
+} // namespace
+
+TEST_CASE("Test counting allocations per VP8 frame from capture to publishing.") {
+    REQUIRE(0 == allocations(true, false));
+}
+
+TEST_CASE("Test counting allocations per VP8 frame from capture to publishing with threads.") {
+    REQUIRE(0 == allocations(true, true));
+}
+
+TEST_CASE("Test counting allocations per VP9 frame from capture to publishing.") {
+    REQUIRE(0 == allocations(false, false));
+}
+
+TEST_CASE("Test counting allocations per VP9 frame from capture to publishing with threads.") {
+    REQUIRE(0 == allocations(false, true));
+}